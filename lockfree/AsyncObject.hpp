@@ -21,59 +21,94 @@ SOFTWARE.
 */
 
 #pragma once
+#include "AsyncObjectInterface.hpp"
+#include "Components.hpp"
+#include "DeferredDeleter.hpp"
+#include "EventNotifier.hpp"
 #include "Messenger.hpp"
+#include "SnapshotPublisher.hpp"
+#include "ThreadConfiguration.hpp"
+#include "TimerWheel.hpp"
 #include "inplace_function.h"
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <limits>
 #include <mutex>
 #include <thread>
+#include <type_traits>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
 namespace lockfree {
 
-class AsyncThread;
-
-namespace detail {
-
 /**
- * An interface abstracting over the different template specialization of Async objects.
+ * The AsyncThread class manages a thread that will perform asynchronously any change submitted to an Async object
+ * attached to it. An Async object needs to be attached to an AsyncThread for it to receive any submitted change.
+ * Each attached object is handled with its own period, which defaults to the one of the AsyncThread. The objects are
+ * scheduled on a hierarchical timing wheel with a resolution of one millisecond, and the thread wakes up only when
+ * some object is due. The objects that are due together are handled by earliest deadline, which is the time the
+ * oldest pending change was submitted plus the latency target of the object.
+ * An AsyncThread can also be driven by an external event loop, without starting its own thread: the loop waits for
+ * the file descriptor returned by getNotificationFd to become readable, and then calls poll or runFor, which handle
+ * all the attached objects regardless of their periods.
  */
-class AsyncObjectInterface : public std::enable_shared_from_this<AsyncObjectInterface>
+class AsyncThread final : private MessengerListener
 {
-  friend class ::lockfree::AsyncThread;
+  using AsyncInterface = detail::AsyncObjectInterface;
+  friend AsyncInterface;
 
 public:
-  virtual ~AsyncObjectInterface() = default;
-
-  AsyncThread* getAsyncThread() const
+  /**
+   * Settings of the adaptive update period, see setAdaptiveUpdatePeriod.
+   */
+  struct AdaptiveUpdatePeriod
   {
-    return asyncThread;
-  }
-
-protected:
-  virtual void timerCallback() = 0;
+    // the period in milliseconds used while changes keep arriving
+    int minPeriod{ 5 };
+    // the period in milliseconds used while idle
+    int maxPeriod{ 1000 };
+    // the cpu time in milliseconds per second that can be spent handling the changes of the objects that do not have
+    // their own period, beyond which the period grows
+    int rebuildBudgetPerSecond{ 100 };
+  };
 
-  void setAsyncThread(AsyncThread* asyncThread_)
+  /**
+   * The statistics of an object attached to the thread.
+   */
+  struct ObjectStats
   {
-    asyncThread = asyncThread_;
-  }
-
-  class AsyncThread* asyncThread{ nullptr };
-};
-
-} // namespace detail
+    // the object the statistics refer to, only meant to be compared with the address of an attached object
+    AsyncInterface const* asyncObject{ nullptr };
+    uint64_t numCallbacks{ 0 };
+    std::chrono::nanoseconds callbackTime{ 0 };
+    std::chrono::nanoseconds maxCallbackTime{ 0 };
+    uint64_t numChangesHandled{ 0 };
+    uint64_t numObjectsBuilt{ 0 };
+    // the number of changes that were pending at the last callback, and the maximum over all the callbacks
+    int numPendingChanges{ 0 };
+    int maxNumPendingChanges{ 0 };
+    // the time between the building of the objects and their pickup by the instances
+    uint64_t numPickups{ 0 };
+    std::chrono::nanoseconds totalPickupDelay{ 0 };
+    std::chrono::nanoseconds maxPickupDelay{ 0 };
+    uint64_t numDeadlineMisses{ 0 };
+  };
 
-/**
- * The AsyncThread class manages a thread that will perform asynchronously any change submitted to an Async object
- * attached to it. An Async object needs to be attached to an AsyncThread for it to receive any submitted change.
- */
-class AsyncThread final
-{
-  using AsyncInterface = detail::AsyncObjectInterface;
-  friend AsyncInterface;
+  /**
+   * The statistics of the thread, see stats.
+   */
+  struct Stats
+  {
+    std::vector<ObjectStats> objects;
+    std::chrono::nanoseconds rebuildTime{ 0 };
+    uint64_t numDeadlineMisses{ 0 };
+    int effectiveUpdatePeriod{ 0 };
+  };
 
-public:
   /**
    * Constructor
    * @period the period in milliseconds with which the thread that receives and handles any change submitted to the
@@ -81,6 +116,8 @@ public:
    */
   explicit AsyncThread(int timerPeriod = 250)
     : timerPeriod{ timerPeriod }
+    , effectivePeriod{ timerPeriod }
+    , startTime{ std::chrono::steady_clock::now() }
   {}
 
   /**
@@ -99,6 +136,11 @@ public:
     auto const lock = std::lock_guard<std::mutex>(mutex);
     asyncObjects.insert(asyncObject.shared_from_this());
     asyncObject.setAsyncThread(this);
+    asyncObject.threadListener.store(this, std::memory_order_release);
+    scheduleObject(asyncObject, getCurrentTick());
+    wakeUp.notify_one();
+    // any change submitted before attaching the object is still pending
+    onMessagesAvailable();
   }
 
   /**
@@ -113,35 +155,128 @@ public:
         return element.get() == &asyncObject;
       });
     if (it != asyncObjects.end()) {
-      asyncObjects.erase(it);
+      wheel.cancel(asyncObject);
+      asyncObject.removeThreadListener();
       asyncObject.setAsyncThread(nullptr);
+      asyncObjects.erase(it);
     }
   }
 
   /**
-   * Starts the thread.
+   * Starts the thread, and applies to it the configuration set with setThreadConfiguration.
+   * @return true if the whole configuration was applied or the thread was already running, false otherwise. The
+   * errors can be inspected with getThreadConfigurationResult.
    */
-  void start()
+  bool start()
   {
     if (isRunningFlag.load(std::memory_order_acquire)) {
-      return;
+      return true;
     }
     stopTimerFlag.store(false, std::memory_order_release);
     isRunningFlag.store(true, std::memory_order_release);
-    timer = std::thread([this]() {
-      while (true) {
-        auto const lock = std::lock_guard<std::mutex>(mutex);
-        for (auto& asyncObject : asyncObjects)
-          asyncObject->timerCallback();
-        if (stopTimerFlag.load(std::memory_order_acquire)) {
-          return;
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(timerPeriod));
-        if (stopTimerFlag.load(std::memory_order_acquire)) {
-          return;
+    auto configurationApplied = std::promise<bool>();
+    auto isConfigurationApplied = configurationApplied.get_future();
+    timer = std::thread([this, &configurationApplied]() {
+      auto lock = std::unique_lock<std::mutex>(mutex);
+      threadConfigurationResult = threadConfiguration.applyToCurrentThread();
+      configurationApplied.set_value(threadConfigurationResult.isSuccessful());
+      // all the objects are handled as soon as the thread starts
+      for (auto& asyncObject : asyncObjects) {
+        wheel.schedule(*asyncObject, wheel.getCurrentTick());
+      }
+      while (!stopTimerFlag.load(std::memory_order_acquire)) {
+        auto const currentTick = getCurrentTick();
+        dueObjects.clear();
+        wheel.advance(currentTick,
+                      [&](TimerWheelNode& node) { dueObjects.push_back(&static_cast<AsyncInterface&>(node)); });
+        if (!dueObjects.empty()) {
+          handleDueObjects();
+          for (auto asyncObject : dueObjects) {
+            scheduleObject(*asyncObject, currentTick);
+          }
+          adaptUpdatePeriod(currentTick);
+          publishStats();
         }
+        auto const ticksToWait = std::min(wheel.getTicksUntilNextEvent(), maxTicksToWait);
+        wakeUp.wait_until(lock, startTime + std::chrono::milliseconds(wheel.getCurrentTick() + ticksToWait));
       }
     });
+    return isConfigurationApplied.get();
+  }
+
+  /**
+   * Sets the configuration to apply to the thread the next time it is started, see ThreadConfiguration.
+   * @param configuration the configuration to apply
+   */
+  void setThreadConfiguration(ThreadConfiguration configuration)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    threadConfiguration = std::move(configuration);
+  }
+
+  /**
+   * @return the errors that occurred applying the configuration the last time the thread was started.
+   */
+  ThreadConfigurationResult getThreadConfigurationResult()
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    return threadConfigurationResult;
+  }
+
+  /**
+   * Handles the changes submitted to the attached objects on the calling thread. It is meant to be used instead of
+   * starting the thread, by an external loop, and it does nothing if the thread is running. See getNotificationFd for
+   * the cost this mode puts on the threads that submit the changes.
+   * @return true if any change has been handled, false otherwise
+   */
+  bool poll()
+  {
+    if (isRunning()) {
+      return false;
+    }
+    // drained before handling the changes: a change submitted while draining is handled below, and any change
+    // submitted later makes the fd readable again
+    notifier.drain();
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    dueObjects.clear();
+    for (auto& asyncObject : asyncObjects) {
+      dueObjects.push_back(asyncObject.get());
+    }
+    bool const anyChange = handleDueObjects();
+    publishStats();
+    return anyChange;
+  }
+
+  /**
+   * Calls poll repeatedly, until there are no more changes to handle or the time budget is over. It is meant to be
+   * used instead of starting the thread, by an external loop, and it does nothing if the thread is running.
+   * @param budget the time after which no more calls to poll are made
+   * @return true if any change has been handled, false otherwise
+   */
+  bool runFor(std::chrono::microseconds budget)
+  {
+    auto const deadline = std::chrono::steady_clock::now() + budget;
+    bool anyChange = false;
+    do {
+      if (!poll()) {
+        break;
+      }
+      anyChange = true;
+    } while (notifier.isNotified() && std::chrono::steady_clock::now() < deadline);
+    return anyChange;
+  }
+
+  /**
+   * @return a file descriptor that becomes readable when a change is submitted to any attached object while the
+   * thread is not running (an eventfd on Linux), to be added to an external event loop, which then calls poll or
+   * runFor. Returns -1 on platforms without support for it.
+   * REMARK: the fd is written by the thread that submits the change, with a write system call, the first time a
+   * change is submitted after poll drains it. When the AsyncThread is driven externally, changes should therefore not
+   * be submitted from a realtime thread, or only when a system call is acceptable there.
+   */
+  int getNotificationFd() const
+  {
+    return notifier.getFd();
   }
 
   /**
@@ -149,7 +284,11 @@ public:
    */
   void stop()
   {
-    stopTimerFlag.store(true, std::memory_order_release);
+    {
+      auto const lock = std::lock_guard<std::mutex>(mutex);
+      stopTimerFlag.store(true, std::memory_order_release);
+    }
+    wakeUp.notify_one();
     if (timer.joinable()) {
       timer.join();
     }
@@ -163,7 +302,128 @@ public:
    */
   void setUpdatePeriod(int period)
   {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
     timerPeriod.store(period, std::memory_order_release);
+    if (!isAdaptive) {
+      setEffectiveUpdatePeriod(period);
+    }
+  }
+
+  /**
+   * Makes the period of the thread adaptive: it shrinks toward a minimum while changes keep arriving, and grows toward
+   * a maximum while idle. It also grows if the cpu time spent handling changes in the last second exceeds a budget, so
+   * that time spent preempted does not count. Only the objects that do not have their own period are affected, and
+   * only their changes and handling time drive the period.
+   * @param settings the settings of the adaptive update period
+   */
+  void setAdaptiveUpdatePeriod(AdaptiveUpdatePeriod settings)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    adaptiveSettings = settings;
+    isAdaptive = true;
+    auto const period = std::clamp(getEffectiveUpdatePeriod(), settings.minPeriod, settings.maxPeriod);
+    setEffectiveUpdatePeriod(period);
+  }
+
+  /**
+   * Goes back to the fixed period set with setUpdatePeriod.
+   */
+  void disableAdaptiveUpdatePeriod()
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    isAdaptive = false;
+    setEffectiveUpdatePeriod(getUpdatePeriod());
+  }
+
+  /**
+   * @return the period in milliseconds currently used for the objects that do not have their own period, which is the
+   * one set with setUpdatePeriod, unless the adaptive update period is enabled.
+   */
+  int getEffectiveUpdatePeriod() const
+  {
+    return effectivePeriod.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @return the total time spent handling the changes submitted to the attached objects and building new objects.
+   */
+  std::chrono::nanoseconds getRebuildTime() const
+  {
+    return std::chrono::nanoseconds(rebuildTime.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * Sets the period in milliseconds with which the thread handles the changes submitted to an attached object.
+   * @param asyncObject the object
+   * @param period the period to set, or 0 to use the period of the AsyncThread
+   */
+  void setUpdatePeriod(AsyncInterface& asyncObject, int period)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    asyncObject.updatePeriod.store(period, std::memory_order_relaxed);
+    if (asyncObject.getAsyncThread() == this) {
+      rescheduleObjectIfLate(asyncObject, getCurrentTick());
+      wakeUp.notify_one();
+    }
+  }
+
+  /**
+   * Sets the time within which a change submitted to an attached object should be handled. When several objects are
+   * due at the same time, the thread handles first the one whose oldest pending change has the earliest deadline. A
+   * change that is handled later than its deadline counts as a deadline miss. A latency target shorter than the update
+   * period of the object can be missed even when the thread is idle.
+   * @param asyncObject the object
+   * @param latencyTarget the latency target in milliseconds, or 0 to use the update period of the object
+   */
+  void setLatencyTarget(AsyncInterface& asyncObject, int latencyTarget)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    asyncObject.latencyTarget.store(latencyTarget, std::memory_order_relaxed);
+  }
+
+  /**
+   * @return the time in milliseconds within which a change submitted to an object should be handled.
+   */
+  int getLatencyTarget(AsyncInterface const& asyncObject) const
+  {
+    auto const latencyTarget = asyncObject.latencyTarget.load(std::memory_order_relaxed);
+    return latencyTarget > 0 ? latencyTarget : getUpdatePeriod(asyncObject);
+  }
+
+  /**
+   * @return the number of times the changes submitted to an object have been handled later than their deadline.
+   */
+  uint64_t getNumDeadlineMisses(AsyncInterface const& asyncObject) const
+  {
+    return asyncObject.numDeadlineMisses.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @return the number of times the changes submitted to any object attached to the thread have been handled later
+   * than their deadline.
+   */
+  uint64_t getNumDeadlineMisses() const
+  {
+    return numDeadlineMisses.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Gets the statistics of the thread and of the attached objects, as they were after the last batch of objects was
+   * handled. Lock-free, it can be called from any thread.
+   * @return the statistics
+   */
+  std::shared_ptr<Stats const> stats() const
+  {
+    return statsPublisher.get();
+  }
+
+  /**
+   * @return the period in milliseconds with which the thread handles the changes submitted to an object.
+   */
+  int getUpdatePeriod(AsyncInterface const& asyncObject) const
+  {
+    auto const period = asyncObject.updatePeriod.load(std::memory_order_relaxed);
+    return period > 0 ? period : getEffectiveUpdatePeriod();
   }
 
   /**
@@ -189,17 +449,361 @@ public:
   ~AsyncThread()
   {
     stop();
-    for (auto& asyncObject : asyncObjects)
+    for (auto& asyncObject : asyncObjects) {
+      wheel.cancel(*asyncObject);
+      asyncObject->removeThreadListener();
       asyncObject->setAsyncThread(nullptr);
+    }
   }
 
 private:
+  static bool isOnDefaultPeriod(AsyncInterface const& asyncObject)
+  {
+    return asyncObject.updatePeriod.load(std::memory_order_relaxed) == 0;
+  }
+
+  uint64_t getCurrentTick() const
+  {
+    auto const elapsed = std::chrono::steady_clock::now() - startTime;
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+  }
+
+  void scheduleObject(AsyncInterface& asyncObject, uint64_t currentTick)
+  {
+    wheel.schedule(asyncObject, currentTick + static_cast<uint64_t>(getUpdatePeriod(asyncObject)));
+  }
+
+  void rescheduleObjectIfLate(AsyncInterface& asyncObject, uint64_t currentTick)
+  {
+    auto const deadline = currentTick + static_cast<uint64_t>(getUpdatePeriod(asyncObject));
+    if (!asyncObject.isScheduled() || asyncObject.getDeadline() > deadline) {
+      wheel.schedule(asyncObject, deadline);
+    }
+  }
+
+  bool handleDueObjects()
+  {
+    for (auto asyncObject : dueObjects) {
+      // taken before handling the changes, so that any change submitted later records its own time
+      auto const pendingSince = asyncObject->pendingSince.exchange(0, std::memory_order_relaxed);
+      asyncObject->deadline = pendingSince == 0
+                                ? std::numeric_limits<int64_t>::max()
+                                : pendingSince + int64_t{ getLatencyTarget(*asyncObject) } * 1000000;
+    }
+    std::sort(dueObjects.begin(), dueObjects.end(), [](AsyncInterface const* lhs, AsyncInterface const* rhs) {
+      return lhs->deadline < rhs->deadline;
+    });
+    bool anyChange = false;
+    anyDefaultPeriodChange = false;
+    for (auto asyncObject : dueObjects) {
+      bool const isLate = detail::getTimeInNanoseconds() > asyncObject->deadline;
+      if (handleObject(*asyncObject)) {
+        anyChange = true;
+        anyDefaultPeriodChange = anyDefaultPeriodChange || isOnDefaultPeriod(*asyncObject);
+        if (isLate) {
+          asyncObject->numDeadlineMisses.fetch_add(1, std::memory_order_relaxed);
+          numDeadlineMisses.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    }
+    return anyChange;
+  }
+
+  bool handleObject(AsyncInterface& asyncObject)
+  {
+    bool const isInBudget = isAdaptive && isOnDefaultPeriod(asyncObject);
+    auto const cpuBegin = isInBudget ? detail::getThreadCpuTimeInNanoseconds() : 0;
+    auto const begin = std::chrono::steady_clock::now();
+    asyncObject.lastNumChanges = 0;
+    bool const anyChange = asyncObject.timerCallback();
+    auto const duration = std::chrono::steady_clock::now() - begin;
+    if (isInBudget) {
+      cpuTimeInWindow += detail::getThreadCpuTimeInNanoseconds() - cpuBegin;
+    }
+    auto const nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    rebuildTime.fetch_add(nanoseconds, std::memory_order_relaxed);
+    auto& counters = asyncObject.counters;
+    ++counters.numCallbacks;
+    counters.callbackTime += nanoseconds;
+    counters.maxCallbackTime = std::max(counters.maxCallbackTime, static_cast<int64_t>(nanoseconds));
+    counters.maxNumPendingChanges = std::max(counters.maxNumPendingChanges, asyncObject.lastNumChanges);
+    return anyChange;
+  }
+
+  void publishStats()
+  {
+    auto newStats = std::make_shared<Stats>();
+    newStats->objects.reserve(asyncObjects.size());
+    for (auto& asyncObject : asyncObjects) {
+      auto const& counters = asyncObject->counters;
+      auto& objectStats = newStats->objects.emplace_back();
+      objectStats.asyncObject = asyncObject.get();
+      objectStats.numCallbacks = counters.numCallbacks;
+      objectStats.callbackTime = std::chrono::nanoseconds(counters.callbackTime);
+      objectStats.maxCallbackTime = std::chrono::nanoseconds(counters.maxCallbackTime);
+      objectStats.numChangesHandled = counters.numChangesHandled;
+      objectStats.numObjectsBuilt = counters.numObjectsBuilt;
+      objectStats.numPendingChanges = asyncObject->lastNumChanges;
+      objectStats.maxNumPendingChanges = counters.maxNumPendingChanges;
+      objectStats.numPickups = asyncObject->numPickups.load(std::memory_order_relaxed);
+      objectStats.totalPickupDelay =
+        std::chrono::nanoseconds(asyncObject->totalPickupDelay.load(std::memory_order_relaxed));
+      objectStats.maxPickupDelay =
+        std::chrono::nanoseconds(asyncObject->maxPickupDelay.load(std::memory_order_relaxed));
+      objectStats.numDeadlineMisses = asyncObject->numDeadlineMisses.load(std::memory_order_relaxed);
+    }
+    newStats->rebuildTime = getRebuildTime();
+    newStats->numDeadlineMisses = getNumDeadlineMisses();
+    newStats->effectiveUpdatePeriod = getEffectiveUpdatePeriod();
+    statsPublisher.publish(std::move(newStats));
+  }
+
+  void adaptUpdatePeriod(uint64_t currentTick)
+  {
+    if (currentTick - budgetWindowStart >= 1000) {
+      budgetWindowStart = currentTick;
+      cpuTimeInWindow = 0;
+    }
+    if (!isAdaptive) {
+      return;
+    }
+    // the objects with their own period neither shrink nor grow the period of the others
+    bool const anyDefaultPeriodObject = std::any_of(dueObjects.begin(), dueObjects.end(), [](auto asyncObject) {
+      return isOnDefaultPeriod(*asyncObject);
+    });
+    if (!anyDefaultPeriodObject) {
+      return;
+    }
+    bool const isOverBudget = cpuTimeInWindow > int64_t{ adaptiveSettings.rebuildBudgetPerSecond } * 1000000;
+    auto const period = getEffectiveUpdatePeriod();
+    bool const isBusy = anyDefaultPeriodChange && !isOverBudget;
+    auto const newPeriod = isBusy ? std::max(adaptiveSettings.minPeriod, period / 2)
+                                  : std::min(adaptiveSettings.maxPeriod, period * 2);
+    if (newPeriod != period) {
+      setEffectiveUpdatePeriod(newPeriod);
+    }
+  }
+
+  void setEffectiveUpdatePeriod(int period)
+  {
+    effectivePeriod.store(period, std::memory_order_release);
+    auto const currentTick = getCurrentTick();
+    for (auto& asyncObject : asyncObjects) {
+      if (isOnDefaultPeriod(*asyncObject)) {
+        rescheduleObjectIfLate(*asyncObject, currentTick);
+      }
+    }
+    wakeUp.notify_one();
+  }
+
+  void onMessagesAvailable() override
+  {
+    // the running thread polls the objects anyway
+    if (!isRunningFlag.load(std::memory_order_relaxed)) {
+      notifier.notify();
+    }
+  }
+
   std::unordered_set<std::shared_ptr<AsyncInterface>> asyncObjects;
+  std::vector<AsyncInterface*> dueObjects;
+  std::atomic<uint64_t> numDeadlineMisses{ 0 };
+  SnapshotPublisher<Stats> statsPublisher{ std::make_shared<Stats const>() };
   std::thread timer;
   std::atomic<bool> stopTimerFlag{ false };
   std::atomic<int> timerPeriod;
+  std::atomic<int> effectivePeriod;
+  AdaptiveUpdatePeriod adaptiveSettings;
+  bool isAdaptive{ false };
+  std::atomic<int64_t> rebuildTime{ 0 };
+  int64_t cpuTimeInWindow{ 0 };
+  bool anyDefaultPeriodChange{ false };
+  uint64_t budgetWindowStart{ 0 };
   std::atomic<bool> isRunningFlag{ false };
+  ThreadConfiguration threadConfiguration;
+  ThreadConfigurationResult threadConfigurationResult;
+  EventNotifier notifier;
+  TimerWheel wheel;
+  std::chrono::steady_clock::time_point const startTime;
+  std::condition_variable wakeUp;
   std::mutex mutex;
+  static constexpr uint64_t maxTicksToWait = 1000;
+};
+
+/**
+ * A group of Async object Instances that are used by the same thread. Instead of calling Instance::update on each of
+ * them, the thread can call InstanceGroup::update, which checks a single atomic epoch that the AsyncThread bumps after
+ * sending a new object to any member, and updates only the members that received one. The members can be Instances of
+ * different Async objects.
+ * Adding and removing members is not lock-free, and must not happen concurrently with InstanceGroup::update.
+ */
+class InstanceGroup final
+{
+public:
+  /**
+   * Constructor.
+   * @param capacity the maximum number of Instances the group can hold
+   */
+  explicit InstanceGroup(int capacity)
+    : dirtyFlags{ new std::atomic<bool>[capacity] }
+    , capacity{ capacity }
+  {
+    for (int i = 0; i < capacity; ++i) {
+      dirtyFlags[i].store(false, std::memory_order_relaxed);
+    }
+    members.reserve(capacity);
+  }
+
+  /**
+   * Adds an Instance to the group, removing it from any other group it belonged to.
+   * @param instance the Instance to add
+   * @return true if the Instance has been added, false if the group is full
+   */
+  template<class Instance>
+  bool add(Instance& instance)
+  {
+    if (instance.getGroup() == this) {
+      return true;
+    }
+    auto const freeSlot = std::find_if(
+      members.begin(), members.end(), [](Member const& member) { return member.instance == nullptr; });
+    if (freeSlot == members.end() && static_cast<int>(members.size()) == capacity) {
+      return false;
+    }
+    auto const member = Member{ &instance,
+                                [](void* instance_) { return static_cast<Instance*>(instance_)->update(); },
+                                [](void* instance_) { static_cast<Instance*>(instance_)->setGroup(nullptr, 0); } };
+    int index;
+    if (freeSlot != members.end()) {
+      *freeSlot = member;
+      index = static_cast<int>(freeSlot - members.begin());
+    }
+    else {
+      members.push_back(member);
+      index = static_cast<int>(members.size()) - 1;
+    }
+    if (auto prevGroup = instance.getGroup()) {
+      prevGroup->remove(instance);
+    }
+    instance.setGroup(this, index);
+    // the instance may have already received an object, so it is checked at the next update
+    markDirty(index);
+    return true;
+  }
+
+  /**
+   * Removes an Instance from the group.
+   * @param instance the Instance to remove
+   */
+  template<class Instance>
+  void remove(Instance& instance)
+  {
+    if (instance.getGroup() != this) {
+      return;
+    }
+    auto const index = instance.getGroupIndex();
+    instance.setGroup(nullptr, 0);
+    members[index] = Member{};
+    while (!members.empty() && members.back().instance == nullptr) {
+      members.pop_back();
+    }
+  }
+
+  /**
+   * Updates the members of the group that have received a new object since the last call. Lock-free, and it does not
+   * touch any member if no new object has been sent to the group.
+   * @return the number of members that have been updated
+   */
+  int update()
+  {
+    auto const currentEpoch = epoch.load(std::memory_order_acquire);
+    if (currentEpoch == lastEpoch) {
+      return 0;
+    }
+    lastEpoch = currentEpoch;
+    int numUpdated = 0;
+    int const numMembers = static_cast<int>(members.size());
+    for (int i = 0; i < numMembers; ++i) {
+      if (dirtyFlags[i].load(std::memory_order_relaxed) && dirtyFlags[i].exchange(false, std::memory_order_acquire)) {
+        auto& member = members[i];
+        if (member.instance && member.update(member.instance)) {
+          ++numUpdated;
+        }
+      }
+    }
+    return numUpdated;
+  }
+
+  /**
+   * @return the number of Instances in the group
+   */
+  int getNumMembers() const
+  {
+    return static_cast<int>(std::count_if(
+      members.begin(), members.end(), [](Member const& member) { return member.instance != nullptr; }));
+  }
+
+  /**
+   * Destructor. It removes all the Instances from the group.
+   */
+  ~InstanceGroup()
+  {
+    for (auto& member : members) {
+      if (member.instance) {
+        member.detach(member.instance);
+      }
+    }
+  }
+
+  InstanceGroup(InstanceGroup const&) = delete;
+  InstanceGroup& operator=(InstanceGroup const&) = delete;
+
+private:
+  template<class TObject_, class TObjectSettings_, size_t ChangeFunctorClosureCapacity_>
+  friend class AsyncObject;
+
+  /**
+   * Called by the AsyncThread after sending a new object to the member at the specified index.
+   */
+  void markDirty(int index)
+  {
+    dirtyFlags[index].store(true, std::memory_order_release);
+    epoch.fetch_add(1, std::memory_order_release);
+  }
+
+  struct Member
+  {
+    void* instance{ nullptr };
+    bool (*update)(void*){ nullptr };
+    void (*detach)(void*){ nullptr };
+  };
+
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> epoch{ 0 };
+  alignas(CACHE_LINE_SIZE) uint64_t lastEpoch{ 0 };
+  std::unique_ptr<std::atomic<bool>[]> dirtyFlags;
+  std::vector<Member> members;
+  int capacity;
+};
+
+/**
+ * Interface for objects that want to be notified when an AsyncObject publishes a new version of its object, e.g. to
+ * resume a coroutine. See AsyncObject::addVersionWaiter.
+ */
+class VersionWaiter
+{
+public:
+  virtual ~VersionWaiter() = default;
+
+  /**
+   * Called on the AsyncThread after a new version has been published. The waiter is removed before the call.
+   */
+  virtual void onNewVersion() = 0;
+
+private:
+  template<class TObject, class TObjectSettings, size_t ChangeFunctorClosureCapacity>
+  friend class AsyncObject;
+
+  VersionWaiter* nextVersionWaiter{ nullptr };
+  bool isWaiting{ false };
 };
 
 /**
@@ -227,10 +831,12 @@ public:
   {
     template<class TObject_, class TObjectSettings_, size_t ChangeFunctorClosureCapacity_>
     friend class AsyncObject;
+    friend class InstanceGroup;
 
   public:
     /**
-     * Updates the instance to the last change submitted to the Async object. Lockfree.
+     * Updates the instance to the last change submitted to the Async object. The replaced object is handed to the
+     * DeferredDeleter of the Async object, to be freed by the AsyncThread. Lockfree.
      * @return true if any change has been received and the instance has been updated, otherwise false
      */
     bool update()
@@ -239,11 +845,17 @@ public:
       auto messageNode = toInstance.receiveLastNode();
       if (messageNode) {
         auto& newObject = messageNode->get();
-        swap(object, newObject);
-        fromInstance.send(messageNode);
-        return true;
+        swap(object, newObject.object);
+        async->recordPickup(newObject.publishTime);
+        messageNode->next() = oldObjects;
+        oldObjects = messageNode;
       }
-      return false;
+      if (oldObjects) {
+        // the objects that cannot be deferred now are kept until the next update
+        oldObjects = async->deleter->deferMessages(
+          oldObjects, toInstance, [](ObjectMessage& message) -> auto& { return message.object; });
+      }
+      return messageNode != nullptr;
     }
 
     /**
@@ -262,20 +874,57 @@ public:
       return *object;
     }
 
+    /**
+     * @return the InstanceGroup the instance belongs to, or nullptr.
+     */
+    InstanceGroup* getGroup() const
+    {
+      return group;
+    }
+
     ~Instance()
     {
+      if (group) {
+        group->remove(*this);
+      }
       async->removeInstance(this);
+      freeMessageStack(oldObjects);
     }
 
   private:
-    explicit Instance(ObjectSettings& objectSettings, std::shared_ptr<AsyncObject> async)
-      : object{ std::make_unique<Object>(objectSettings) }
+    explicit Instance(std::unique_ptr<Object> object, std::shared_ptr<AsyncObject> async)
+      : object{ std::move(object) }
       , async{ std::move(async) }
     {}
 
+    int getGroupIndex() const
+    {
+      return groupIndex;
+    }
+
+    void setGroup(InstanceGroup* group_, int groupIndex_)
+    {
+      auto const lock = std::lock_guard<std::mutex>(async->mutex);
+      group = group_;
+      groupIndex = groupIndex_;
+    }
+
+    /**
+     * An object sent to the instance, with the time it was built at, to measure the delay of its pickup.
+     */
+    struct ObjectMessage final
+    {
+      std::unique_ptr<Object> object;
+      int64_t publishTime{ 0 };
+    };
+
     std::unique_ptr<Object> object;
-    Messenger<std::unique_ptr<Object>> toInstance;
-    Messenger<std::unique_ptr<Object>> fromInstance;
+    InstanceGroup* group{ nullptr };
+    int groupIndex{ 0 };
+    // sent by the AsyncThread, received by the thread that owns the instance, which recycles the nodes
+    Messenger<ObjectMessage, Producers::single, Consumers::single> toInstance;
+    // the old objects that the thread that owns the instance could not defer yet
+    MessageNode<ObjectMessage>* oldObjects{ nullptr };
     std::shared_ptr<AsyncObject> async;
   };
 
@@ -324,10 +973,9 @@ public:
     }
 
   private:
-    bool handleChanges(ObjectSettings& objectSettings)
+    int handleChanges()
     {
-      int numChanges = receiveAndHandleMessageStack(messenger, [&](ChangeSettings& change) { change(objectSettings); });
-      return numChanges > 0;
+      return receiveAndHandleMessageStack(messenger, [&](ChangeSettings& change) { async->applyChange(change); });
     }
 
     explicit Producer(std::shared_ptr<AsyncObject> async)
@@ -348,8 +996,14 @@ public:
   {
     auto const lock = std::lock_guard<std::mutex>(mutex);
     auto instance = std::unique_ptr<Instance>(
-      new Instance(objectSettings, std::static_pointer_cast<AsyncObject>(this->shared_from_this())));
+      new Instance(makeObject(), std::static_pointer_cast<AsyncObject>(this->shared_from_this())));
     instances.push_back(instance.get());
+    // each instance discards at most one object between two consecutive collections, and the nodes of the instances
+    // that have been destroyed are reused by the new ones
+    auto const numNodesNeeded = static_cast<int>(instances.size()) - deleter->getNumNodes();
+    if (numNodesNeeded > 0) {
+      deleter->allocateNodes(numNodesNeeded);
+    }
     return instance;
   }
 
@@ -362,10 +1016,123 @@ public:
     auto const lock = std::lock_guard<std::mutex>(mutex);
     auto producer =
       std::unique_ptr<Producer>(new Producer(std::static_pointer_cast<AsyncObject>(this->shared_from_this())));
+    producer->messenger.setListener(this->getChangeListener());
     producers.push_back(producer.get());
     return producer;
   }
 
+  /**
+   * Submit a change to Async object from any thread, without the need of a Producer. Each thread that calls this
+   * method gets its own implicit producer, which is created, with its preallocated nodes, the first time the thread
+   * submits a change to this object, and it is disposed of after the thread exits.
+   * It is not lock-free, as it may create the implicit producer or allocate an internal node of the lifo stack.
+   * @return true if the node was available a no allocation has been made, false otherwise
+   */
+  bool submitChange(ChangeSettings change)
+  {
+    return getImplicitProducer().messenger.send(std::move(change));
+  }
+
+  /**
+   * Submit a change to Async object from any thread, without the need of a Producer, like submitChange.
+   * It does not submit the change if the lifo stack of the implicit producer of the calling thread is empty. It is
+   * lock-free, except for the first time it is called from a thread, which creates the implicit producer.
+   * @return true if the change was submitted, false if the lifo stack is empty.
+   */
+  bool submitChangeIfNodeAvailable(ChangeSettings change)
+  {
+    return getImplicitProducer().messenger.sendIfNodeAvailable(std::move(change));
+  }
+
+  /**
+   * Adds a component to the object, see Components. Each time the settings change, the component is rebuilt only if
+   * any of the fields it depends on has changed. This requires the ObjectSettings to derive from TrackedSettings,
+   * otherwise each change is considered to affect all the fields. The Object can access the components if it has a
+   * constructor with signature Object(ObjectSettings const&, Components<ObjectSettings> const&).
+   * @param dependencies the fields of the settings used to build the component
+   * @param builder a functor with signature Component(ObjectSettings const&) that builds the component
+   */
+  template<class Component, class Builder>
+  void addComponent(SettingsFields dependencies, Builder builder)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    components.template add<Component>(dependencies, std::move(builder), objectSettings);
+  }
+
+  /**
+   * Gets a snapshot of the current settings, as they were after the last batch of changes handled by the AsyncThread.
+   * Lock-free, it can be called from any thread. Snapshots are only published if the ObjectSettings are copy
+   * constructible, in which case the AsyncThread copies the settings once per batch of changes: use a PersistentMap, or
+   * members held by shared_ptr, to keep the copy cheap.
+   * @return the snapshot of the settings
+   */
+  std::shared_ptr<ObjectSettings const> settingsSnapshot() const
+  {
+    static_assert(isPublishingSettings, "settingsSnapshot requires copy constructible ObjectSettings");
+    return settingsPublisher.get();
+  }
+
+  /**
+   * @return the number of times a new object has been published to the instances, which is the version of the
+   * current object
+   */
+  uint64_t getVersion() const
+  {
+    return version.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Adds a waiter to notify once, when a version greater than the given one is published. It does not allocate, but
+   * it locks a mutex: it must not be called from a realtime thread.
+   * @param waiter the waiter, which must stay alive until it is notified
+   * @param currentVersion the version the waiter is waiting to be replaced
+   * @return true if the waiter was added, false if a greater version has already been published, in which case the
+   * waiter is not notified
+   */
+  bool addVersionWaiter(VersionWaiter& waiter, uint64_t currentVersion)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    if (version.load(std::memory_order_relaxed) > currentVersion) {
+      return false;
+    }
+    waiter.nextVersionWaiter = versionWaiters;
+    waiter.isWaiting = true;
+    versionWaiters = &waiter;
+    return true;
+  }
+
+  /**
+   * Removes a waiter added with addVersionWaiter, if it has not been notified yet, so that it can be destroyed before
+   * a new version is published. It locks a mutex: it must not be called from a realtime thread.
+   * @param waiter the waiter
+   * @return true if the waiter was removed, false if it had already been notified
+   */
+  bool removeVersionWaiter(VersionWaiter& waiter)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    if (!waiter.isWaiting) {
+      return false;
+    }
+    for (auto link = &versionWaiters; *link; link = &(*link)->nextVersionWaiter) {
+      if (*link == &waiter) {
+        *link = waiter.nextVersionWaiter;
+        break;
+      }
+    }
+    waiter.nextVersionWaiter = nullptr;
+    waiter.isWaiting = false;
+    return true;
+  }
+
+  /**
+   * Sets the number of nodes to preallocate for each implicit producer that will be created by submitChange.
+   * @numNodes the number of nodes to preallocate
+   */
+  void setNumNodesPerImplicitProducer(int numNodes)
+  {
+    numNodesPerImplicitProducer.store(numNodes, std::memory_order_relaxed);
+  }
+
   /**
    * Destructor. If the object was attached to an AsyncThread, it detached it
    */
@@ -387,10 +1154,21 @@ public:
   }
 
 private:
-  explicit AsyncObject(ObjectSettings objectSettings)
-    : objectSettings{ std::move(objectSettings) }
+  explicit AsyncObject(ObjectSettings objectSettings_)
+    : objectSettings{ std::move(objectSettings_) }
+    , settingsPublisher{ makeSettingsSnapshot() }
   {}
 
+  std::shared_ptr<ObjectSettings const> makeSettingsSnapshot() const
+  {
+    if constexpr (isPublishingSettings) {
+      return std::make_shared<ObjectSettings const>(objectSettings);
+    }
+    else {
+      return nullptr;
+    }
+  }
+
   template<class T>
   void removeAddressFromStorage(T* address, std::vector<T*>& storage)
   {
@@ -413,30 +1191,185 @@ private:
     removeAddressFromStorage(producer, producers);
   }
 
-  void timerCallback() override
+  /**
+   * The producer of changes used by a thread calling AsyncObject::submitChange. It is owned by the AsyncObject, and
+   * disposed of by the AsyncThread after the thread exits.
+   */
+  struct ImplicitProducer final
   {
-    auto const lock = std::lock_guard<std::mutex>(mutex);
-    for (auto& instance : instances) {
-      instance->fromInstance.discardAndFreeAllMessages();
+    Messenger<ChangeSettings> messenger;
+    std::atomic<bool> isThreadAlive{ true };
+  };
+
+  /**
+   * The implicit producers used by a thread, one for each AsyncObject the thread submitted changes to.
+   */
+  class ImplicitProducerCache final
+  {
+  public:
+    struct Entry
+    {
+      AsyncObject* asyncObject;
+      std::weak_ptr<AsyncObjectInterface> asyncObjectLifetime;
+      ImplicitProducer* producer;
+    };
+
+    static ImplicitProducerCache& get()
+    {
+      static thread_local ImplicitProducerCache cache;
+      return cache;
     }
-    bool anyChange = false;
-    for (auto& producer : producers) {
-      bool const anyChangeFromProducer = producer->handleChanges(objectSettings);
-      if (anyChangeFromProducer) {
-        anyChange = true;
+
+    ImplicitProducer* find(AsyncObject* asyncObject)
+    {
+      for (auto& entry : entries) {
+        // the address may belong to an object that has been destroyed, and another one created in its place
+        if (entry.asyncObject == asyncObject && !entry.asyncObjectLifetime.expired()) {
+          return entry.producer;
+        }
       }
+      return nullptr;
     }
+
+    void add(Entry entry)
+    {
+      entries.erase(std::remove_if(entries.begin(),
+                                   entries.end(),
+                                   [](Entry const& entry_) { return entry_.asyncObjectLifetime.expired(); }),
+                    entries.end());
+      entries.push_back(std::move(entry));
+    }
+
+    ~ImplicitProducerCache()
+    {
+      for (auto& entry : entries) {
+        if (auto const asyncObject = entry.asyncObjectLifetime.lock()) {
+          entry.producer->isThreadAlive.store(false, std::memory_order_release);
+        }
+      }
+    }
+
+  private:
+    std::vector<Entry> entries;
+  };
+
+  ImplicitProducer& getImplicitProducer()
+  {
+    auto& cache = ImplicitProducerCache::get();
+    if (auto producer = cache.find(this)) {
+      return *producer;
+    }
+    auto producer = std::make_unique<ImplicitProducer>();
+    producer->messenger.allocateNodes(numNodesPerImplicitProducer.load(std::memory_order_relaxed));
+    auto const producerPtr = producer.get();
+    {
+      auto const lock = std::lock_guard<std::mutex>(mutex);
+      producer->messenger.setListener(this->getChangeListener());
+      implicitProducers.push_back(std::move(producer));
+    }
+    cache.add({ this, this->weak_from_this(), producerPtr });
+    return *producerPtr;
+  }
+
+  static constexpr bool isTrackingSettings = std::is_base_of_v<TrackedSettings, ObjectSettings>;
+  static constexpr bool isPublishingSettings = std::is_copy_constructible_v<ObjectSettings>;
+
+  void applyChange(ChangeSettings& change)
+  {
+    change(objectSettings);
+    if constexpr (isTrackingSettings) {
+      objectSettings.endChange();
+    }
+  }
+
+  std::unique_ptr<Object> makeObject()
+  {
+    if constexpr (std::is_constructible_v<Object, ObjectSettings const&, Components<ObjectSettings> const&>) {
+      return std::make_unique<Object>(std::as_const(objectSettings), std::as_const(components));
+    }
+    else {
+      return std::make_unique<Object>(objectSettings);
+    }
+  }
+
+  int handleChangesFromImplicitProducers()
+  {
+    int numChanges = 0;
+    for (auto& producer : implicitProducers) {
+      // read before handling the changes, so that no change can be submitted after the last ones are handled
+      bool const isThreadAlive = producer->isThreadAlive.load(std::memory_order_acquire);
+      numChanges +=
+        receiveAndHandleMessageStack(producer->messenger, [&](ChangeSettings& change) { applyChange(change); });
+      if (!isThreadAlive) {
+        producer.reset();
+      }
+    }
+    implicitProducers.erase(std::remove(implicitProducers.begin(), implicitProducers.end(), nullptr),
+                            implicitProducers.end());
+    return numChanges;
+  }
+
+  bool timerCallback() override
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    deleter->collect();
+    int numChanges = handleChangesFromImplicitProducers();
+    for (auto& producer : producers) {
+      numChanges += producer->handleChanges();
+    }
+    bool const anyChange = numChanges > 0;
     if (anyChange) {
+      if constexpr (isTrackingSettings) {
+        components.rebuild(objectSettings, objectSettings.takeChangedFields());
+      }
+      else {
+        components.rebuild(objectSettings, allSettingsFields);
+      }
+      auto const publishTime = detail::getTimeInNanoseconds();
       for (auto& instance : instances) {
         instance->toInstance.discardAndFreeAllMessages();
-        instance->toInstance.send(std::make_unique<Object>(objectSettings));
+        instance->toInstance.send({ makeObject(), publishTime });
+        if (instance->group) {
+          instance->group->markDirty(instance->groupIndex);
+        }
       }
+      if constexpr (isPublishingSettings) {
+        settingsPublisher.publish(makeSettingsSnapshot());
+      }
+      version.fetch_add(1, std::memory_order_release);
+      notifyVersionWaiters();
+    }
+    else {
+      settingsPublisher.reclaim();
+    }
+    recordChangesHandled(numChanges, anyChange ? static_cast<int>(instances.size()) : 0);
+    return anyChange;
+  }
+
+  void notifyVersionWaiters()
+  {
+    auto waiter = versionWaiters;
+    versionWaiters = nullptr;
+    while (waiter) {
+      // a notified waiter may be destroyed right away
+      auto const next = waiter->nextVersionWaiter;
+      waiter->nextVersionWaiter = nullptr;
+      waiter->isWaiting = false;
+      waiter->onNewVersion();
+      waiter = next;
     }
   }
 
   std::vector<Producer*> producers;
+  std::vector<std::unique_ptr<ImplicitProducer>> implicitProducers;
+  std::atomic<int> numNodesPerImplicitProducer{ 16 };
   std::vector<Instance*> instances;
+  std::shared_ptr<DeferredDeleter<>> deleter{ DeferredDeleter<>::create(0) };
   ObjectSettings objectSettings;
+  Components<ObjectSettings> components;
+  SnapshotPublisher<ObjectSettings> settingsPublisher;
+  std::atomic<uint64_t> version{ 0 };
+  VersionWaiter* versionWaiters{ nullptr };
   std::mutex mutex;
 };
 
@@ -0,0 +1,196 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "Messenger.hpp"
+#include "TimerWheel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#endif
+
+namespace lockfree {
+
+class AsyncThread;
+
+namespace detail {
+
+/**
+ * @return the time of the steady clock in nanoseconds
+ */
+inline int64_t getTimeInNanoseconds()
+{
+  auto const now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+/**
+ * @return the cpu time consumed by the calling thread in nanoseconds, or the time of the steady clock where it is not
+ * available
+ */
+inline int64_t getThreadCpuTimeInNanoseconds()
+{
+#if defined(__unix__) || defined(__APPLE__)
+  timespec time;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0) {
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+  }
+#endif
+  return getTimeInNanoseconds();
+}
+
+/**
+ * An interface abstracting over the different template specialization of Async objects.
+ */
+class AsyncObjectInterface
+  : public std::enable_shared_from_this<AsyncObjectInterface>
+  , private TimerWheelNode
+  , private MessengerListener
+{
+  friend class ::lockfree::AsyncThread;
+
+public:
+  virtual ~AsyncObjectInterface() = default;
+
+  AsyncThread* getAsyncThread() const
+  {
+    return asyncThread;
+  }
+
+protected:
+  /**
+   * Handles the changes submitted to the object. Called by the AsyncThread.
+   * @return true if any change has been handled, false otherwise
+   */
+  virtual bool timerCallback() = 0;
+
+  /**
+   * @return the listener to set on the messengers through which the changes are submitted to the object. It records
+   * when the oldest pending change was submitted, and notifies the AsyncThread the object is attached to.
+   */
+  MessengerListener* getChangeListener()
+  {
+    return this;
+  }
+
+  /**
+   * Records the work done by a call to timerCallback, for the statistics of the AsyncThread.
+   * @param numChanges the number of changes handled
+   * @param numObjectsBuilt the number of objects built and sent to the instances
+   */
+  void recordChangesHandled(int numChanges, int numObjectsBuilt)
+  {
+    lastNumChanges = numChanges;
+    counters.numChangesHandled += static_cast<uint64_t>(numChanges);
+    counters.numObjectsBuilt += static_cast<uint64_t>(numObjectsBuilt);
+  }
+
+  /**
+   * Records the time between the building of an object and its pickup by an instance. Lock-free, called by the
+   * threads that own the instances.
+   * @param publishTime the time in nanoseconds at which the object was built
+   */
+  void recordPickup(int64_t publishTime)
+  {
+    auto const delay = getTimeInNanoseconds() - publishTime;
+    numPickups.fetch_add(1, std::memory_order_relaxed);
+    totalPickupDelay.fetch_add(delay, std::memory_order_relaxed);
+    auto maxDelay = maxPickupDelay.load(std::memory_order_relaxed);
+    while (delay > maxDelay && !maxPickupDelay.compare_exchange_weak(maxDelay, delay, std::memory_order_relaxed)) {
+    }
+  }
+
+  void setAsyncThread(AsyncThread* asyncThread_)
+  {
+    asyncThread = asyncThread_;
+  }
+
+  class AsyncThread* asyncThread{ nullptr };
+
+private:
+  void onMessagesAvailable() override
+  {
+    auto const nanoseconds = std::max<int64_t>(1, getTimeInNanoseconds());
+    int64_t noPendingChange = 0;
+    pendingSince.compare_exchange_strong(noPendingChange, nanoseconds, std::memory_order_relaxed);
+    // counted before loading the listener, so that removeThreadListener waits for this call to be done with it
+    numNotifications.fetch_add(1, std::memory_order_seq_cst);
+    if (auto const listener = threadListener.load(std::memory_order_seq_cst)) {
+      listener->onMessagesAvailable();
+    }
+    numNotifications.fetch_sub(1, std::memory_order_release);
+  }
+
+  /**
+   * Removes the listener of the AsyncThread, and waits for the threads that may still be notifying it, so that the
+   * AsyncThread can be destroyed right after. Called by the AsyncThread when the object is detached.
+   */
+  void removeThreadListener()
+  {
+    threadListener.store(nullptr, std::memory_order_seq_cst);
+    while (numNotifications.load(std::memory_order_seq_cst) > 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  // the listener of the AsyncThread the object is attached to
+  std::atomic<MessengerListener*> threadListener{ nullptr };
+  // the number of threads that are in onMessagesAvailable
+  std::atomic<int> numNotifications{ 0 };
+  // the time in nanoseconds at which the oldest pending change was submitted, 0 if there is no pending change
+  std::atomic<int64_t> pendingSince{ 0 };
+  // the period with which the AsyncThread handles the changes to this object, 0 to use the one of the AsyncThread.
+  // Written under the mutex of the AsyncThread, and atomic as it can be read from any thread.
+  std::atomic<int> updatePeriod{ 0 };
+  // the time in milliseconds within which a submitted change should be handled, 0 to use the update period. Written
+  // under the mutex of the AsyncThread, and atomic as it can be read from any thread.
+  std::atomic<int> latencyTarget{ 0 };
+  // the time in nanoseconds by which the pending changes should be handled, computed by the AsyncThread
+  int64_t deadline{ 0 };
+  std::atomic<uint64_t> numDeadlineMisses{ 0 };
+
+  // written by the AsyncThread, and read by it to publish its statistics
+  struct Counters
+  {
+    uint64_t numCallbacks{ 0 };
+    int64_t callbackTime{ 0 };
+    int64_t maxCallbackTime{ 0 };
+    uint64_t numChangesHandled{ 0 };
+    uint64_t numObjectsBuilt{ 0 };
+    int maxNumPendingChanges{ 0 };
+  };
+  Counters counters;
+  int lastNumChanges{ 0 };
+
+  // written by the threads that own the instances
+  std::atomic<uint64_t> numPickups{ 0 };
+  std::atomic<int64_t> totalPickupDelay{ 0 };
+  std::atomic<int64_t> maxPickupDelay{ 0 };
+};
+
+} // namespace detail
+
+} // namespace lockfree
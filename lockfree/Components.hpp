@@ -0,0 +1,163 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <typeindex>
+#include <unordered_map>
+
+namespace lockfree {
+
+/**
+ * A bit mask of fields of some settings. Each field is identified by a bit, so there can be up to 64 of them.
+ */
+using SettingsFields = uint64_t;
+
+/**
+ * The SettingsFields value that includes all the fields.
+ */
+constexpr SettingsFields allSettingsFields = ~SettingsFields{ 0 };
+
+/**
+ * A base class for ObjectSettings that keeps track of which fields have been changed. A ChangeSettings functor calls
+ * markChanged with the fields it modifies. A change that does not mark any field is considered to change all of them.
+ */
+class TrackedSettings
+{
+public:
+  /**
+   * Marks some fields as changed.
+   * @param fields the fields to mark
+   */
+  void markChanged(SettingsFields fields)
+  {
+    changedFields |= fields;
+    isAnyFieldMarked = true;
+  }
+
+  /**
+   * Called after each change is applied to the settings.
+   */
+  void endChange()
+  {
+    if (!isAnyFieldMarked) {
+      changedFields = allSettingsFields;
+    }
+    isAnyFieldMarked = false;
+  }
+
+  /**
+   * @return the fields changed since the last call, and clears them.
+   */
+  SettingsFields takeChangedFields()
+  {
+    auto const fields = changedFields;
+    changedFields = 0;
+    return fields;
+  }
+
+private:
+  SettingsFields changedFields{ 0 };
+  bool isAnyFieldMarked{ false };
+};
+
+/**
+ * A set of immutable components of an Object, each one depending on some fields of the ObjectSettings, that are
+ * rebuilt only when any of those fields change. An Object built from the same Components shares with the previous
+ * versions all the components that were not rebuilt. Components are identified by their type, so there can be only
+ * one component of each type.
+ * @tparam ObjectSettings the settings used to build the components
+ */
+template<class ObjectSettings>
+class Components final
+{
+public:
+  /**
+   * Adds a component and builds it.
+   * @param dependencies the fields of the settings used to build the component
+   * @param builder a functor with signature Component(ObjectSettings const&) that builds the component
+   * @param objectSettings the settings to build the component with
+   */
+  template<class Component, class Builder>
+  void add(SettingsFields dependencies, Builder builder, ObjectSettings const& objectSettings)
+  {
+    auto entry = Entry{ dependencies,
+                        [builder = std::move(builder)](ObjectSettings const& settings) -> std::shared_ptr<void const> {
+                          return std::make_shared<Component const>(builder(settings));
+                        },
+                        nullptr };
+    entry.component = entry.build(objectSettings);
+    entries[std::type_index(typeid(Component))] = std::move(entry);
+  }
+
+  /**
+   * Rebuilds the components that depend on any of the changed fields.
+   * @param objectSettings the settings to build the components with
+   * @param changedFields the fields that have been changed
+   * @return the number of components that have been rebuilt
+   */
+  int rebuild(ObjectSettings const& objectSettings, SettingsFields changedFields)
+  {
+    int numRebuilt = 0;
+    for (auto& [type, entry] : entries) {
+      if (entry.dependencies & changedFields) {
+        entry.component = entry.build(objectSettings);
+        ++numRebuilt;
+      }
+    }
+    return numRebuilt;
+  }
+
+  /**
+   * @return the component of the specified type, or nullptr if there is none.
+   */
+  template<class Component>
+  std::shared_ptr<Component const> get() const
+  {
+    auto const it = entries.find(std::type_index(typeid(Component)));
+    if (it == entries.end()) {
+      return nullptr;
+    }
+    return std::static_pointer_cast<Component const>(it->second.component);
+  }
+
+  /**
+   * @return the number of components
+   */
+  int size() const
+  {
+    return static_cast<int>(entries.size());
+  }
+
+private:
+  struct Entry
+  {
+    SettingsFields dependencies;
+    std::function<std::shared_ptr<void const>(ObjectSettings const&)> build;
+    std::shared_ptr<void const> component;
+  };
+
+  std::unordered_map<std::type_index, Entry> entries;
+};
+
+} // namespace lockfree
@@ -0,0 +1,261 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include "AsyncObject.hpp"
+#include "Messenger.hpp"
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstdint>
+
+namespace lockfree {
+
+/**
+ * Interface for the executors on which the coroutines waiting for a Messenger or an AsyncObject are resumed.
+ */
+class CoroutineExecutor
+{
+public:
+  virtual ~CoroutineExecutor() = default;
+
+  /**
+   * Schedules a coroutine to be resumed. It is called on the thread that made the awaited event happen, such as the
+   * thread that sent a message, so it should be quick and must not resume the coroutine itself.
+   * @param coroutine the coroutine to resume
+   */
+  virtual void post(std::coroutine_handle<> coroutine) = 0;
+};
+
+/**
+ * A CoroutineExecutor that queues the coroutines in a Messenger with preallocated nodes, and resumes them when run is
+ * called. Posting a coroutine is lock-free, and it only allocates if there are no nodes available.
+ */
+class CoroutineQueue final : public CoroutineExecutor
+{
+public:
+  /**
+   * Constructor.
+   * @param numNodesToPreallocate the number of coroutines that can be queued without allocating
+   */
+  explicit CoroutineQueue(int numNodesToPreallocate)
+  {
+    messenger.allocateNodes(numNodesToPreallocate);
+  }
+
+  void post(std::coroutine_handle<> coroutine) override
+  {
+    messenger.send(std::move(coroutine));
+  }
+
+  /**
+   * Resumes the queued coroutines, in the order they were posted.
+   * @return the number of coroutines resumed
+   */
+  int run()
+  {
+    return receiveAndHandleMessageStack(messenger, [](std::coroutine_handle<>& coroutine) { coroutine.resume(); });
+  }
+
+private:
+  Messenger<std::coroutine_handle<>> messenger;
+};
+
+/**
+ * Lets a coroutine wait for the messages of a Messenger with co_await receiver.receive(). The coroutine is resumed on
+ * the executor when a message is sent to the Messenger while it is empty, and the awaiting does not allocate.
+ * The receiver sets itself as the listener of the Messenger, so it must outlive the senders, and only one coroutine at
+ * a time can receive the messages. The Messenger must not have a listener already, as a Messenger notifies a single
+ * listener: it cannot be awaited while an AsyncThread or another CoroutineReceiver listens to it.
+ * @tparam T the type of the messages
+ * @tparam producers the producers policy of the Messenger
+ * @tparam consumers the consumers policy of the Messenger
+ */
+template<typename T, Producers producers = Producers::multiple, Consumers consumers = Consumers::multiple>
+class CoroutineReceiver final : private MessengerListener
+{
+public:
+  /**
+   * The awaitable returned by receive. Awaiting it gives the head node of the stack of the messages, as returned by
+   * Messenger::receiveAllNodes, which is never nullptr.
+   */
+  class Awaitable final
+  {
+  public:
+    bool await_ready() const
+    {
+      return !receiver.messenger.empty();
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine)
+    {
+      receiver.waitingCoroutine.store(coroutine.address(), std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (receiver.messenger.empty()) {
+        return true;
+      }
+      // a message arrived in the meantime: if the sender took the coroutine, it has already posted it
+      return receiver.waitingCoroutine.exchange(nullptr, std::memory_order_acquire) == nullptr;
+    }
+
+    MessageNode<T>* await_resume()
+    {
+      return receiver.messenger.receiveAllNodes();
+    }
+
+  private:
+    friend class CoroutineReceiver;
+
+    explicit Awaitable(CoroutineReceiver& receiver)
+      : receiver{ receiver }
+    {}
+
+    CoroutineReceiver& receiver;
+  };
+
+  /**
+   * Constructor.
+   * @param messenger the Messenger to receive the messages from
+   * @param executor the executor on which to resume the waiting coroutine
+   */
+  CoroutineReceiver(Messenger<T, producers, consumers>& messenger, CoroutineExecutor& executor)
+    : messenger{ messenger }
+    , executor{ executor }
+  {
+    assert(messenger.getListener() == nullptr && "the Messenger already has a listener");
+    messenger.setListener(this);
+  }
+
+  /**
+   * @return an awaitable that gives the stack of the messages, waiting for them if there are none
+   */
+  Awaitable receive()
+  {
+    return Awaitable{ *this };
+  }
+
+  /**
+   * Destructor. It removes the receiver from the listener of the Messenger, leaving the Messenger without a listener.
+   */
+  ~CoroutineReceiver() override
+  {
+    assert(messenger.getListener() == this && "the listener of the Messenger was replaced");
+    messenger.setListener(nullptr);
+  }
+
+  CoroutineReceiver(CoroutineReceiver const&) = delete;
+  CoroutineReceiver& operator=(CoroutineReceiver const&) = delete;
+
+private:
+  void onMessagesAvailable() override
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (auto coroutine = waitingCoroutine.exchange(nullptr, std::memory_order_acquire)) {
+      executor.post(std::coroutine_handle<>::from_address(coroutine));
+    }
+  }
+
+  Messenger<T, producers, consumers>& messenger;
+  CoroutineExecutor& executor;
+  std::atomic<void*> waitingCoroutine{ nullptr };
+};
+
+/**
+ * The awaitable returned by nextVersion.
+ * @tparam AsyncObjectType the type of the AsyncObject
+ */
+template<class AsyncObjectType>
+class NextVersionAwaitable final : private VersionWaiter
+{
+public:
+  bool await_ready() const
+  {
+    return asyncObject.getVersion() > currentVersion;
+  }
+
+  bool await_suspend(std::coroutine_handle<> coroutine_)
+  {
+    coroutine = coroutine_;
+    isAdded = asyncObject.addVersionWaiter(*this, currentVersion);
+    return isAdded;
+  }
+
+  /**
+   * @return the version of the object, which is greater than the one at the time nextVersion was called
+   */
+  uint64_t await_resume() const
+  {
+    return asyncObject.getVersion();
+  }
+
+  NextVersionAwaitable(AsyncObjectType& asyncObject, CoroutineExecutor& executor, uint64_t currentVersion)
+    : asyncObject{ asyncObject }
+    , executor{ executor }
+    , currentVersion{ currentVersion }
+  {}
+
+  /**
+   * Destructor. If the awaiting coroutine is destroyed while suspended, it removes the waiter from the AsyncObject,
+   * which must still be alive.
+   */
+  ~NextVersionAwaitable() override
+  {
+    if (isAdded) {
+      asyncObject.removeVersionWaiter(*this);
+    }
+  }
+
+  NextVersionAwaitable(NextVersionAwaitable const&) = delete;
+  NextVersionAwaitable& operator=(NextVersionAwaitable const&) = delete;
+
+private:
+  void onNewVersion() override
+  {
+    executor.post(coroutine);
+  }
+
+  AsyncObjectType& asyncObject;
+  CoroutineExecutor& executor;
+  uint64_t const currentVersion;
+  std::coroutine_handle<> coroutine;
+  bool isAdded{ false };
+};
+
+/**
+ * Lets a coroutine wait with co_await nextVersion(asyncObject, executor) until the AsyncObject publishes a new version
+ * of its object. The coroutine is resumed on the executor, and the awaiting does not allocate. It must not be awaited
+ * by a realtime thread, see AsyncObject::addVersionWaiter.
+ * @param asyncObject the AsyncObject
+ * @param executor the executor on which to resume the coroutine
+ * @return the awaitable, which gives the version of the object
+ */
+template<class TObject, class TObjectSettings, size_t ChangeFunctorClosureCapacity>
+NextVersionAwaitable<AsyncObject<TObject, TObjectSettings, ChangeFunctorClosureCapacity>> nextVersion(
+  AsyncObject<TObject, TObjectSettings, ChangeFunctorClosureCapacity>& asyncObject,
+  CoroutineExecutor& executor)
+{
+  return { asyncObject, executor, asyncObject.getVersion() };
+}
+
+} // namespace lockfree
+
+#endif
@@ -0,0 +1,266 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "AsyncObjectInterface.hpp"
+#include "Messenger.hpp"
+#include "NodePool.hpp"
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace lockfree {
+
+/**
+ * A type-erased object whose destruction has been deferred. The object is stored in place, so it must fit in Capacity
+ * bytes, and it must be nothrow move constructible. Resetting the DeferredDestruction destroys the object.
+ * @tparam Capacity the size of the storage
+ */
+template<size_t Capacity>
+class DeferredDestruction final
+{
+public:
+  DeferredDestruction() = default;
+
+  /**
+   * Constructor.
+   * @param object the object to destroy later
+   */
+  template<class T, class = std::enable_if_t<!std::is_same_v<std::decay_t<T>, DeferredDestruction>>>
+  explicit DeferredDestruction(T&& object)
+  {
+    using Object = std::decay_t<T>;
+    static_assert(sizeof(Object) <= Capacity, "The object is too big for the DeferredDestruction");
+    static_assert(alignof(Object) <= alignof(std::max_align_t), "The object is overaligned");
+    static_assert(std::is_nothrow_move_constructible_v<Object>, "The object must be nothrow move constructible");
+    new (&storage) Object(std::forward<T>(object));
+    operations = &operationsOf<Object>;
+  }
+
+  DeferredDestruction(DeferredDestruction&& other) noexcept
+  {
+    moveFrom(other);
+  }
+
+  DeferredDestruction& operator=(DeferredDestruction&& other) noexcept
+  {
+    if (this != &other) {
+      reset();
+      moveFrom(other);
+    }
+    return *this;
+  }
+
+  /**
+   * Destroys the object, if any.
+   */
+  void reset()
+  {
+    if (operations) {
+      operations->destroy(&storage);
+      operations = nullptr;
+    }
+  }
+
+  /**
+   * @return true if there is an object to destroy, false otherwise
+   */
+  explicit operator bool() const
+  {
+    return operations != nullptr;
+  }
+
+  ~DeferredDestruction()
+  {
+    reset();
+  }
+
+  DeferredDestruction(DeferredDestruction const&) = delete;
+  DeferredDestruction& operator=(DeferredDestruction const&) = delete;
+
+private:
+  struct Operations
+  {
+    void (*move)(void* destination, void* source);
+    void (*destroy)(void* object);
+  };
+
+  template<class Object>
+  static constexpr Operations operationsOf{
+    [](void* destination, void* source) {
+      auto& object = *static_cast<Object*>(source);
+      new (destination) Object(std::move(object));
+      object.~Object();
+    },
+    [](void* object) { static_cast<Object*>(object)->~Object(); }
+  };
+
+  void moveFrom(DeferredDestruction& other)
+  {
+    if (other.operations) {
+      other.operations->move(&storage, &other.storage);
+      operations = other.operations;
+      other.operations = nullptr;
+    }
+  }
+
+  std::aligned_storage_t<Capacity, alignof(std::max_align_t)> storage;
+  Operations const* operations{ nullptr };
+};
+
+/**
+ * Moves the destruction of objects, such as unique_ptrs, shared_ptrs, vectors and buffers, away from the real-time
+ * threads. A real-time thread defers the destruction of an object through a lock-free stack, in a node taken from a
+ * preallocated NodePool, so several real-time threads can share a deleter, and the objects are destroyed when collect
+ * is called, either by a non real-time thread, or by an AsyncThread the deleter is
+ * attached to. Any object that is still deferred when the DeferredDeleter is destroyed is destroyed with it.
+ * @tparam ObjectCapacity the maximum size of the objects whose destruction can be deferred
+ */
+template<size_t ObjectCapacity = 32>
+class DeferredDeleter final : public detail::AsyncObjectInterface
+{
+public:
+  using Destruction = DeferredDestruction<ObjectCapacity>;
+
+  /**
+   * Creates a DeferredDeleter.
+   * @param numNodesToPreallocate the number of objects that can be deferred without allocating before collect is
+   * called
+   */
+  static std::shared_ptr<DeferredDeleter> create(int numNodesToPreallocate)
+  {
+    auto deleter = std::shared_ptr<DeferredDeleter>(new DeferredDeleter());
+    deleter->allocateNodes(numNodesToPreallocate);
+    return deleter;
+  }
+
+  /**
+   * Defers the destruction of an object if a preallocated node is available. Lock-free. If there is no node
+   * available, the object is not moved from, and the caller should keep it and try again later.
+   * @param object the object to destroy later
+   * @return true if the destruction of the object was deferred, false otherwise
+   */
+  template<class T>
+  bool deferIfNodeAvailable(T&& object)
+  {
+    static_assert(!std::is_lvalue_reference_v<T>, "The object must be passed as an rvalue");
+    auto node = pool.pop();
+    if (!node) {
+      return false;
+    }
+    node->get() = Destruction(std::move(object));
+    messenger.send(node);
+    return true;
+  }
+
+  /**
+   * Defers the destruction of an object. It is not lock-free, as it allocates a node if there is none available.
+   * @param object the object to destroy later
+   */
+  template<class T>
+  void defer(T&& object)
+  {
+    static_assert(!std::is_lvalue_reference_v<T>, "The object must be passed as an rvalue");
+    auto node = pool.popOrAllocate();
+    node->get() = Destruction(std::move(object));
+    messenger.send(node);
+  }
+
+  /**
+   * Defers the destruction of the messages held by a stack of nodes, as long as there are preallocated nodes
+   * available, and recycles the emptied nodes into a Messenger. Lock-free.
+   * @param stack the stack of nodes holding the objects to destroy later
+   * @param recycler the Messenger in which to recycle the emptied nodes
+   * @param getObject a functor returning a reference to the object to destroy later, given a message
+   * @return the stack of the nodes whose messages could not be deferred, which should be passed again later
+   */
+  template<class T, Producers producers, Consumers consumers, class GetObject>
+  MessageNode<T>* deferMessages(MessageNode<T>* stack,
+                                Messenger<T, producers, consumers>& recycler,
+                                GetObject getObject)
+  {
+    while (stack && deferIfNodeAvailable(std::move(getObject(stack->get())))) {
+      auto const node = stack;
+      stack = node->next();
+      node->next() = nullptr;
+      recycler.recycle(node);
+    }
+    return stack;
+  }
+
+  /**
+   * Destroys all the objects deferred so far. It must not be called from a real-time thread.
+   * @return the number of objects destroyed
+   */
+  int collect()
+  {
+    auto const stack = messenger.receiveAllNodes();
+    if (!stack) {
+      return 0;
+    }
+    auto const numObjects = stack->count();
+    handleMessageStack(stack, [](Destruction& destruction) { destruction.reset(); });
+    pool.recycle(stack);
+    return numObjects;
+  }
+
+  /**
+   * Preallocates nodes, so that more objects can be deferred without allocating before collect is called.
+   * @param numNodesToAllocate the number of nodes to allocate
+   */
+  void allocateNodes(int numNodesToAllocate)
+  {
+    pool.allocateNodes(numNodesToAllocate);
+  }
+
+  /**
+   * @return the number of nodes allocated so far, including the ones holding deferred objects
+   */
+  int getNumNodes() const
+  {
+    return static_cast<int>(pool.getNumNodes());
+  }
+
+  /**
+   * Destructor. It destroys the objects that are still deferred.
+   */
+  ~DeferredDeleter() override
+  {
+    collect();
+  }
+
+private:
+  DeferredDeleter() = default;
+
+  bool timerCallback() override
+  {
+    collect();
+    // collecting is not a change, and must not make an adaptive AsyncThread speed up
+    return false;
+  }
+
+  NodePool<Destruction> pool;
+  Messenger<Destruction> messenger;
+};
+
+} // namespace lockfree
@@ -0,0 +1,234 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "QueueWorld/QwConfig.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace lockfree {
+
+/**
+ * A single-writer ring buffer of events read by several consumers, each at its own pace, in the style of the LMAX
+ * Disruptor. Every consumer sees every event in place, so fanning a stream out to many readers costs no copies.
+ * The writer and each consumer publish the sequence number of the last event they have written or consumed, and a
+ * consumer can depend on others, in which case it only reads the events they have already consumed: this way a
+ * consumer can annotate the events for the ones that depend on it. The writer does not overwrite an event until every
+ * consumer has consumed it.
+ * Writing and consuming are wait-free, and both can be done in batches.
+ * @tparam T the type of the events, which must be default constructible
+ */
+template<class T>
+class Disruptor final
+{
+public:
+  /**
+   * A reader of the events. Each consumer must be used by one thread at a time.
+   */
+  class Consumer final
+  {
+  public:
+    /**
+     * @return the sequence number of the last event that can be read, which may be lower than the one of the last
+     * event consumed if there are no new events
+     */
+    int64_t getAvailableSequence() const
+    {
+      auto available = disruptor.cursor.load(std::memory_order_acquire);
+      for (auto dependency : dependencies) {
+        available = std::min(available, dependency->sequence.load(std::memory_order_acquire));
+      }
+      return available;
+    }
+
+    /**
+     * @param sequence the sequence number of an event, which must be greater than the one of the last event
+     * consumed, and not greater than the one returned by getAvailableSequence
+     * @return the event
+     */
+    T& get(int64_t sequence)
+    {
+      return disruptor.events[static_cast<size_t>(sequence & disruptor.mask)];
+    }
+
+    /**
+     * Marks the events up to a sequence number as consumed, so that the writer can overwrite them and the consumers
+     * that depend on this one can read them.
+     * @param sequence the sequence number of the last event consumed
+     */
+    void release(int64_t sequence)
+    {
+      this->sequence.store(sequence, std::memory_order_release);
+    }
+
+    /**
+     * @return the sequence number of the last event consumed, or -1 if none has been
+     */
+    int64_t getSequence() const
+    {
+      return sequence.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Handles the available events, in order, and marks them as consumed.
+     * @param handler a functor with signature void(T& event, int64_t sequence)
+     * @param maxNumEvents the maximum number of events to handle
+     * @return the number of events handled
+     */
+    template<class Handler>
+    int64_t consume(Handler handler, int64_t maxNumEvents = INT64_MAX)
+    {
+      auto const first = sequence.load(std::memory_order_relaxed) + 1;
+      auto last = getAvailableSequence();
+      if (last - first >= maxNumEvents) {
+        last = first + maxNumEvents - 1;
+      }
+      for (auto i = first; i <= last; ++i) {
+        handler(get(i), i);
+      }
+      if (last < first) {
+        return 0;
+      }
+      release(last);
+      return last - first + 1;
+    }
+
+  private:
+    friend class Disruptor;
+
+    Consumer(Disruptor& disruptor, std::vector<Consumer const*> dependencies)
+      : disruptor{ disruptor }
+      , dependencies{ std::move(dependencies) }
+    {}
+
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> sequence{ -1 };
+    Disruptor& disruptor;
+    std::vector<Consumer const*> dependencies;
+  };
+
+  /**
+   * Constructor.
+   * @param capacity the number of events in the ring, rounded up to a power of two
+   */
+  explicit Disruptor(int capacity)
+  {
+    int64_t size = 1;
+    while (size < capacity) {
+      size *= 2;
+    }
+    mask = size - 1;
+    events.reset(new T[static_cast<size_t>(size)]);
+  }
+
+  /**
+   * Adds a consumer. It must be called before the first event is written.
+   * @param dependencies the consumers that must consume an event before the new one can read it
+   * @return the consumer, which lives as long as the Disruptor
+   */
+  Consumer& addConsumer(std::vector<Consumer const*> dependencies = {})
+  {
+    consumers.push_back(std::unique_ptr<Consumer>(new Consumer(*this, std::move(dependencies))));
+    return *consumers.back();
+  }
+
+  /**
+   * Writes events in place, as many as there is room for, and publishes them. Only the writer thread can call it.
+   * @param maxNumEvents the maximum number of events to write
+   * @param writer a functor with signature void(T& event, int64_t sequence)
+   * @return the number of events written
+   */
+  template<class Writer>
+  int64_t tryWrite(int64_t maxNumEvents, Writer writer)
+  {
+    auto const first = cursor.load(std::memory_order_relaxed) + 1;
+    // the last sequence there is room for, compared by differences so that a large maxNumEvents cannot overflow
+    auto last = cachedGatingSequence + mask + 1;
+    if (last - first + 1 < maxNumEvents) {
+      cachedGatingSequence = getGatingSequence();
+      last = cachedGatingSequence + mask + 1;
+    }
+    if (last - first >= maxNumEvents) {
+      last = first + maxNumEvents - 1;
+    }
+    for (auto i = first; i <= last; ++i) {
+      writer(events[static_cast<size_t>(i & mask)], i);
+    }
+    if (last < first) {
+      return 0;
+    }
+    cursor.store(last, std::memory_order_release);
+    return last - first + 1;
+  }
+
+  /**
+   * Writes an event in place, if there is room for it, and publishes it. Only the writer thread can call it.
+   * @param writer a functor with signature void(T& event, int64_t sequence)
+   * @return true if the event was written, false if the slowest consumer has not consumed the event it would replace
+   */
+  template<class Writer>
+  bool tryWrite(Writer writer)
+  {
+    return tryWrite(1, writer) == 1;
+  }
+
+  /**
+   * @return the sequence number of the last event published, or -1 if none has been
+   */
+  int64_t getCursor() const
+  {
+    return cursor.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @return the number of events in the ring
+   */
+  int64_t getCapacity() const
+  {
+    return mask + 1;
+  }
+
+  Disruptor(Disruptor const&) = delete;
+  Disruptor& operator=(Disruptor const&) = delete;
+
+private:
+  int64_t getGatingSequence() const
+  {
+    auto gatingSequence = cursor.load(std::memory_order_relaxed);
+    for (auto& consumer : consumers) {
+      gatingSequence = std::min(gatingSequence, consumer->sequence.load(std::memory_order_acquire));
+    }
+    return gatingSequence;
+  }
+
+  // on its own cache line, as the writer stores to it on each tryWrite while the consumers poll it
+  alignas(CACHE_LINE_SIZE) std::atomic<int64_t> cursor{ -1 };
+  // only read after construction
+  alignas(CACHE_LINE_SIZE) std::unique_ptr<T[]> events;
+  int64_t mask{ 0 };
+  std::vector<std::unique_ptr<Consumer>> consumers;
+  // only used by the writer
+  alignas(CACHE_LINE_SIZE) int64_t cachedGatingSequence{ -1 };
+};
+
+} // namespace lockfree
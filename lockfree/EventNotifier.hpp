@@ -0,0 +1,138 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#define LOCKFREE_EVENT_NOTIFIER_EVENTFD 1
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define LOCKFREE_EVENT_NOTIFIER_PIPE 1
+#endif
+
+namespace lockfree {
+
+/**
+ * A file descriptor that becomes readable when notified, so that it can be added to an event loop (epoll, poll,
+ * libuv, GLib...). It uses an eventfd on Linux and a pipe on other POSIX systems. Elsewhere there is no file
+ * descriptor, but the pending state can still be checked and drained.
+ * Consecutive notifications are coalesced: the file descriptor stays readable until drain is called.
+ */
+class EventNotifier final
+{
+public:
+  EventNotifier()
+  {
+#if defined(LOCKFREE_EVENT_NOTIFIER_EVENTFD)
+    readFd = writeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif defined(LOCKFREE_EVENT_NOTIFIER_PIPE)
+    int fds[2];
+    if (pipe(fds) == 0) {
+      for (int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+      }
+      readFd = fds[0];
+      writeFd = fds[1];
+    }
+#endif
+  }
+
+  /**
+   * Makes the file descriptor readable. Non-blocking, but it is a system call the first time it is called after a
+   * drain.
+   */
+  void notify()
+  {
+    if (isPending.exchange(true, std::memory_order_acq_rel)) {
+      return;
+    }
+#if defined(LOCKFREE_EVENT_NOTIFIER_EVENTFD) || defined(LOCKFREE_EVENT_NOTIFIER_PIPE)
+    if (writeFd >= 0) {
+      uint64_t const one = 1;
+      auto const numWritten = write(writeFd, &one, sizeof(one));
+      (void)numWritten;
+    }
+#endif
+  }
+
+  /**
+   * Clears the notification, so that the file descriptor is no longer readable. The notifications made while draining
+   * are cleared as well, so the caller must check for the events it waits for after calling it.
+   * @return true if there was a pending notification, false otherwise
+   */
+  bool drain()
+  {
+    // read before clearing: a notification made while draining finds the pending flag set and does not write, so the
+    // fd can never be left empty with the flag set, which would make every later notification return early
+#if defined(LOCKFREE_EVENT_NOTIFIER_EVENTFD) || defined(LOCKFREE_EVENT_NOTIFIER_PIPE)
+    if (readFd >= 0) {
+      uint64_t buffer[8];
+      while (read(readFd, buffer, sizeof(buffer)) > 0) {
+      }
+    }
+#endif
+    return isPending.exchange(false, std::memory_order_acq_rel);
+  }
+
+  /**
+   * @return true if there is a pending notification
+   */
+  bool isNotified() const
+  {
+    return isPending.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @return the file descriptor to wait for, or -1 if it is not available
+   */
+  int getFd() const
+  {
+    return readFd;
+  }
+
+  ~EventNotifier()
+  {
+#if defined(LOCKFREE_EVENT_NOTIFIER_EVENTFD) || defined(LOCKFREE_EVENT_NOTIFIER_PIPE)
+    if (readFd >= 0) {
+      close(readFd);
+    }
+    if (writeFd >= 0 && writeFd != readFd) {
+      close(writeFd);
+    }
+#endif
+  }
+
+  EventNotifier(EventNotifier const&) = delete;
+  EventNotifier& operator=(EventNotifier const&) = delete;
+
+private:
+  int readFd{ -1 };
+  int writeFd{ -1 };
+  std::atomic<bool> isPending{ false };
+};
+
+} // namespace lockfree
@@ -0,0 +1,305 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "QueueWorld/QwConfig.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace lockfree {
+
+/**
+ * A lock-free multiple-producer multiple-consumer FIFO queue, which, unlike a Messenger, lets each consumer receive
+ * one message at a time, so that several consumers can share the load.
+ * It is a Michael-Scott queue whose nodes live in an arena of chunks that are never freed before the queue, and are
+ * referred to by 32 bit indices tagged with 32 bit counters, so that the nodes can be recycled without ABA problems.
+ * The arena has a fixed number of chunks, so at most maxNumNodes nodes can ever be allocated, one of which is the dummy
+ * node of the queue: beyond that cap, send fails as sendIfNodeAvailable does when there are no nodes available.
+ * A node is recycled after it has been released twice: once by the consumer that moves its message out, and once
+ * when the head of the queue moves past it, so no consumer ever reads a message from a recycled node.
+ * As for the Messenger, the nodes can be preallocated, and sending a message with sendIfNodeAvailable and receiving it
+ * are lock-free and do not allocate.
+ * @tparam T the type of the messages, which must be default constructible and move assignable
+ */
+template<class T>
+class FifoMessenger final
+{
+  static constexpr uint32_t nullIndex = 0;
+  static constexpr uint32_t nodesPerChunk = 256;
+  static constexpr uint32_t maxNumChunks = 4096;
+
+  struct Node
+  {
+    // the index of the next node in the queue, tagged
+    std::atomic<uint64_t> next{ 0 };
+    // the index of the next node in the list of free nodes
+    std::atomic<uint32_t> nextFree{ nullIndex };
+    std::atomic<int> numReleasesLeft{ 0 };
+    T message{};
+  };
+
+  static uint32_t getIndex(uint64_t tagged)
+  {
+    return static_cast<uint32_t>(tagged);
+  }
+
+  static uint64_t makeTagged(uint32_t index, uint64_t prevTagged)
+  {
+    return ((prevTagged >> 32) + 1) << 32 | index;
+  }
+
+public:
+  /**
+   * The maximum number of nodes that can be allocated, including the dummy node of the queue.
+   */
+  static constexpr int maxNumNodes = static_cast<int>(nodesPerChunk * maxNumChunks);
+
+  /**
+   * Constructor.
+   * @param numNodesToPreallocate the number of messages that can be sent without allocating
+   */
+  explicit FifoMessenger(int numNodesToPreallocate = 0)
+  {
+    auto const dummy = allocateNode();
+    node(dummy).numReleasesLeft.store(1, std::memory_order_relaxed);
+    head.store(makeTagged(dummy, 0), std::memory_order_relaxed);
+    tail.store(makeTagged(dummy, 0), std::memory_order_relaxed);
+    allocateNodes(numNodesToPreallocate);
+  }
+
+  /**
+   * Sends a message, using a node from the storage if there is one available, otherwise it allocates a new one, in
+   * which case it locks a mutex.
+   * @param message the message to send, which is not moved from if it is not sent
+   * @return true if the message was sent, false if there was no node available and maxNumNodes nodes have already been
+   * allocated
+   */
+  bool send(T&& message)
+  {
+    auto index = popFreeNode();
+    if (index == nullIndex) {
+      index = allocateNode();
+      if (index == nullIndex) {
+        return false;
+      }
+    }
+    enqueue(index, std::move(message));
+    return true;
+  }
+
+  /**
+   * Sends a message if there is a node available in the storage. Lock-free.
+   * @param message the message to send, which is not moved from if no node is available
+   * @return true if the message was sent, false otherwise
+   */
+  bool sendIfNodeAvailable(T&& message)
+  {
+    auto const index = popFreeNode();
+    if (index == nullIndex) {
+      return false;
+    }
+    enqueue(index, std::move(message));
+    return true;
+  }
+
+  /**
+   * Receives the oldest message. Lock-free.
+   * @return the message, or nothing if there are no messages
+   */
+  std::optional<T> receive()
+  {
+    while (true) {
+      auto headTagged = head.load(std::memory_order_acquire);
+      auto const tailTagged = tail.load(std::memory_order_acquire);
+      auto const nextTagged = node(getIndex(headTagged)).next.load(std::memory_order_acquire);
+      if (headTagged != head.load(std::memory_order_acquire)) {
+        continue;
+      }
+      auto const nextIndex = getIndex(nextTagged);
+      if (getIndex(headTagged) == getIndex(tailTagged)) {
+        if (nextIndex == nullIndex) {
+          return std::nullopt;
+        }
+        // the tail is lagging behind
+        auto expected = tailTagged;
+        tail.compare_exchange_strong(expected, makeTagged(nextIndex, tailTagged), std::memory_order_acq_rel);
+        continue;
+      }
+      if (head.compare_exchange_strong(headTagged, makeTagged(nextIndex, headTagged), std::memory_order_acq_rel)) {
+        // the next node is now the dummy, and it cannot be recycled before it is released here
+        auto message = std::optional<T>(std::move(node(nextIndex).message));
+        release(nextIndex);
+        release(getIndex(headTagged));
+        return message;
+      }
+    }
+  }
+
+  /**
+   * Receives at most a number of messages, and handles them with a functor, in the order they were sent. Lock-free.
+   * @param maxNumMessages the maximum number of messages to receive
+   * @param handler the functor, with signature void(T& message)
+   * @return the number of messages received
+   */
+  template<class Handler>
+  int receive(int maxNumMessages, Handler handler)
+  {
+    int numMessages = 0;
+    while (numMessages < maxNumMessages) {
+      auto message = receive();
+      if (!message) {
+        break;
+      }
+      handler(*message);
+      ++numMessages;
+    }
+    return numMessages;
+  }
+
+  /**
+   * @return true if there were no messages at the time of the call, false otherwise
+   */
+  bool empty() const
+  {
+    auto const headTagged = head.load(std::memory_order_acquire);
+    return getIndex(node(getIndex(headTagged)).next.load(std::memory_order_acquire)) == nullIndex;
+  }
+
+  /**
+   * Allocates nodes and puts them into the storage, ready to be used for sending messages. It locks a mutex.
+   * @param numNodesToAllocate the number of nodes to allocate
+   * @return the number of nodes allocated, which is less than requested only if maxNumNodes nodes have been allocated
+   */
+  int allocateNodes(int numNodesToAllocate)
+  {
+    for (int i = 0; i < numNodesToAllocate; ++i) {
+      auto const index = allocateNode();
+      if (index == nullIndex) {
+        return i;
+      }
+      pushFreeNode(index);
+    }
+    return numNodesToAllocate;
+  }
+
+  /**
+   * Destructor.
+   */
+  ~FifoMessenger()
+  {
+    for (uint32_t chunk = 0; chunk < maxNumChunks; ++chunk) {
+      delete[] chunks[chunk].load(std::memory_order_relaxed);
+    }
+  }
+
+  FifoMessenger(FifoMessenger const&) = delete;
+  FifoMessenger& operator=(FifoMessenger const&) = delete;
+
+private:
+  Node& node(uint32_t index) const
+  {
+    auto const position = index - 1;
+    return chunks[position / nodesPerChunk].load(std::memory_order_acquire)[position % nodesPerChunk];
+  }
+
+  uint32_t allocateNode()
+  {
+    auto const lock = std::lock_guard<std::mutex>(allocationMutex);
+    if (numAllocatedNodes % nodesPerChunk == 0) {
+      auto const chunk = numAllocatedNodes / nodesPerChunk;
+      if (chunk == maxNumChunks) {
+        return nullIndex;
+      }
+      chunks[chunk].store(new Node[nodesPerChunk], std::memory_order_release);
+    }
+    return ++numAllocatedNodes;
+  }
+
+  void enqueue(uint32_t index, T&& message)
+  {
+    auto& newNode = node(index);
+    newNode.message = std::move(message);
+    newNode.numReleasesLeft.store(2, std::memory_order_relaxed);
+    auto const oldNext = newNode.next.load(std::memory_order_relaxed);
+    newNode.next.store(makeTagged(nullIndex, oldNext), std::memory_order_release);
+    while (true) {
+      auto tailTagged = tail.load(std::memory_order_acquire);
+      auto& tailNode = node(getIndex(tailTagged));
+      auto nextTagged = tailNode.next.load(std::memory_order_acquire);
+      if (tailTagged != tail.load(std::memory_order_acquire)) {
+        continue;
+      }
+      if (getIndex(nextTagged) == nullIndex) {
+        if (tailNode.next.compare_exchange_strong(
+              nextTagged, makeTagged(index, nextTagged), std::memory_order_acq_rel)) {
+          tail.compare_exchange_strong(tailTagged, makeTagged(index, tailTagged), std::memory_order_acq_rel);
+          return;
+        }
+      }
+      else {
+        // the tail is lagging behind
+        tail.compare_exchange_strong(
+          tailTagged, makeTagged(getIndex(nextTagged), tailTagged), std::memory_order_acq_rel);
+      }
+    }
+  }
+
+  void release(uint32_t index)
+  {
+    if (node(index).numReleasesLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      pushFreeNode(index);
+    }
+  }
+
+  void pushFreeNode(uint32_t index)
+  {
+    auto& freeNode = node(index);
+    auto topTagged = freeTop.load(std::memory_order_relaxed);
+    do {
+      freeNode.nextFree.store(getIndex(topTagged), std::memory_order_relaxed);
+    } while (!freeTop.compare_exchange_weak(topTagged, makeTagged(index, topTagged), std::memory_order_acq_rel));
+  }
+
+  uint32_t popFreeNode()
+  {
+    auto topTagged = freeTop.load(std::memory_order_acquire);
+    while (getIndex(topTagged) != nullIndex) {
+      auto const nextFree = node(getIndex(topTagged)).nextFree.load(std::memory_order_relaxed);
+      if (freeTop.compare_exchange_weak(topTagged, makeTagged(nextFree, topTagged), std::memory_order_acq_rel)) {
+        return getIndex(topTagged);
+      }
+    }
+    return nullIndex;
+  }
+
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head{ 0 };
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail{ 0 };
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> freeTop{ 0 };
+  std::atomic<Node*> chunks[maxNumChunks]{};
+  uint32_t numAllocatedNodes{ 0 };
+  std::mutex allocationMutex;
+};
+
+} // namespace lockfree
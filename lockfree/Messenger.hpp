@@ -22,6 +22,7 @@ SOFTWARE.
 
 #pragma once
 
+#include "EventNotifier.hpp"
 #include "QueueWorld/QwMpmcPopAllLifoStack.h"
 #include <algorithm>
 #include <atomic>
@@ -182,32 +183,250 @@ inline void freeMessageStack(MessageNode<T>* head)
 }
 
 /**
- * An alias for QueueWorld's QwMpmcPopAllLifoStack.
+ * Compile-time policy describing how many threads can push concurrently into a LifoStack, or send concurrently
+ * through a Messenger.
+ */
+enum class Producers
+{
+  single,
+  multiple
+};
+
+/**
+ * Compile-time policy describing how many threads can pop concurrently from a LifoStack, or receive concurrently
+ * through a Messenger.
+ */
+enum class Consumers
+{
+  single,
+  multiple
+};
+
+/**
+ * A lock-free LIFO stack of MessageNodes supporting push() and pop_all(). The default, multiple-producer, version is a
+ * thin wrapper around QueueWorld's QwMpmcPopAllLifoStack.
+ * The Consumers policy does not change the algorithm, as pop_all() is a single atomic exchange regardless of how many
+ * threads call it, but it documents the intended use. pop_all() checks whether the stack is empty with a relaxed load
+ * before the exchange, so polling an empty stack does not generate coherence traffic.
  * @tparam T the type of the data held by the nodes
+ * @tparam producers whether one or more threads can push into the stack concurrently
+ * @tparam consumers whether one or more threads can pop from the stack concurrently
  */
-template<typename T>
-using LifoStack = QwMpmcPopAllLifoStack<MessageNode<T>*, MessageNode<T>::LINK_INDEX_1>;
+template<typename T, Producers producers = Producers::multiple, Consumers consumers = Consumers::multiple>
+class LifoStack final
+{
+  QwMpmcPopAllLifoStack<MessageNode<T>*, MessageNode<T>::LINK_INDEX_1> stack;
+
+public:
+  void push(MessageNode<T>* node)
+  {
+    stack.push(node);
+  }
+
+  void push(MessageNode<T>* node, bool& wasEmpty)
+  {
+    stack.push(node, wasEmpty);
+  }
+
+  void push_multiple(MessageNode<T>* front, MessageNode<T>* back)
+  {
+    stack.push_multiple(front, back);
+  }
+
+  void push_multiple(MessageNode<T>* front, MessageNode<T>* back, bool& wasEmpty)
+  {
+    stack.push_multiple(front, back, wasEmpty);
+  }
+
+  bool empty() const
+  {
+    return stack.empty();
+  }
+
+  MessageNode<T>* pop_all()
+  {
+    // a relaxed load keeps the cache line shared when there is nothing to pop, while the exchange would take it
+    // exclusive and move it away from the producers
+    if (stack.empty()) {
+      return nullptr;
+    }
+    return stack.pop_all();
+  }
+};
+
+/**
+ * Single-producer version of the LifoStack. As the only thing a consumer can do to the top of the stack is to swap it
+ * with nullptr, an empty stack can only be refilled by the producer, which can then use a plain release store instead
+ * of a compare-and-swap. If the stack is not empty, a single compare-and-swap is attempted, and if it fails it means
+ * that a consumer has emptied the stack in the meantime, so a plain store is used again. Pushing is thus wait-free.
+ * @tparam T the type of the data held by the nodes
+ * @tparam consumers whether one or more threads can pop from the stack concurrently
+ */
+template<typename T, Consumers consumers>
+class LifoStack<T, Producers::single, consumers> final
+{
+  std::atomic<MessageNode<T>*> top{ nullptr };
+
+public:
+  void push(MessageNode<T>* node)
+  {
+    bool wasEmpty;
+    push_multiple(node, node, wasEmpty);
+  }
+
+  void push(MessageNode<T>* node, bool& wasEmpty)
+  {
+    push_multiple(node, node, wasEmpty);
+  }
+
+  void push_multiple(MessageNode<T>* front, MessageNode<T>* back)
+  {
+    bool wasEmpty;
+    push_multiple(front, back, wasEmpty);
+  }
+
+  void push_multiple(MessageNode<T>* front, MessageNode<T>* back, bool& wasEmpty)
+  {
+    auto prevTop = top.load(std::memory_order_relaxed);
+    back->next() = prevTop;
+    if (prevTop) {
+      if (top.compare_exchange_strong(prevTop, front, std::memory_order_release, std::memory_order_relaxed)) {
+        wasEmpty = false;
+        return;
+      }
+      // the stack has been emptied by a consumer, and nobody but us can fill it again
+      back->next() = nullptr;
+    }
+    top.store(front, std::memory_order_release);
+    wasEmpty = true;
+  }
+
+  bool empty() const
+  {
+    return top.load(std::memory_order_relaxed) == nullptr;
+  }
+
+  MessageNode<T>* pop_all()
+  {
+    if (empty()) {
+      return nullptr;
+    }
+    return top.exchange(nullptr, std::memory_order_acquire);
+  }
+};
+
+/**
+ * Interface for objects that want to know when a Messenger receives a message while it was empty, e.g. to wake up the
+ * thread that receives the messages.
+ */
+class MessengerListener
+{
+public:
+  virtual ~MessengerListener() = default;
+
+  /**
+   * Called on the sending thread after a message is sent to an empty Messenger.
+   */
+  virtual void onMessagesAvailable() = 0;
+};
 
 /**
  * Wrapper around QueueWorld's QwMpmcPopAllLifoStack with functionality to
  * allocate and recycle nodes.
  * @tparam T the type of the data held by the nodes, char is used as default for
  * Messages that are just notification and do not need to have data.
+ * @tparam producers whether one or more threads can send messages concurrently. Producers::single uses a wait-free
+ * push, see LifoStack.
+ * @tparam consumers whether one or more threads can receive messages concurrently.
+ * REMARK: the policies only apply to the stack of messages. The storage of the nodes to recycle is accessed by both
+ * the senders and the receivers, so it is always a multiple-producer multiple-consumer stack.
  */
-template<typename T>
+template<typename T, Producers producers = Producers::multiple, Consumers consumers = Consumers::multiple>
 class Messenger final
 {
-  LifoStack<T> lifo;
+  LifoStack<T, producers, consumers> lifo;
   LifoStack<T> storage;
+  std::atomic<MessengerListener*> listener{ nullptr };
+  std::atomic<EventNotifier*> notifier{ nullptr };
+  std::unique_ptr<EventNotifier> notifierStorage;
+
+  void push(MessageNode<T>* front, MessageNode<T>* back)
+  {
+    bool wasEmpty;
+    lifo.push_multiple(front, back, wasEmpty);
+    if (wasEmpty) {
+      if (auto const notifier_ = notifier.load(std::memory_order_acquire)) {
+        notifier_->notify();
+      }
+      if (auto const listener_ = listener.load(std::memory_order_acquire)) {
+        listener_->onMessagesAvailable();
+      }
+    }
+  }
 
 public:
+  /**
+   * Sets the listener to notify when a message is sent while the Messenger is empty. The listener must outlive the
+   * Messenger, or be replaced before being destroyed.
+   * @param listener_ the listener, or nullptr to remove it.
+   */
+  void setListener(MessengerListener* listener_)
+  {
+    listener.store(listener_, std::memory_order_release);
+  }
+
+  /**
+   * @return the listener to notify when a message is sent while the Messenger is empty, or nullptr if there is none
+   */
+  MessengerListener* getListener() const
+  {
+    return listener.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Enables the notification file descriptor, which becomes readable when a message is sent while the Messenger is
+   * empty, so that the consumer can wait for messages in an event loop (epoll, poll, GLib...) without polling. It
+   * allocates and opens the file descriptor, and should be called before the Messenger is used by other threads.
+   * The notification does not use the listener, which remains available.
+   */
+  void enableNotification()
+  {
+    if (notifierStorage) {
+      return;
+    }
+    notifierStorage = std::make_unique<EventNotifier>();
+    notifier.store(notifierStorage.get(), std::memory_order_release);
+    if (!lifo.empty()) {
+      notifierStorage->notify();
+    }
+  }
+
+  /**
+   * @return the notification file descriptor, or -1 if the notification is not enabled or the platform has no file
+   * descriptors, see EventNotifier.
+   */
+  int getNotificationFd() const
+  {
+    return notifierStorage ? notifierStorage->getFd() : -1;
+  }
+
+  /**
+   * Clears the notification, so that the file descriptor is no longer readable. It must be called before receiving
+   * the messages: a message sent after the call either is received, or makes the file descriptor readable again.
+   * @return true if there was a pending notification, false otherwise.
+   */
+  bool drainNotification()
+  {
+    return notifierStorage ? notifierStorage->drain() : false;
+  }
+
   /**
    * Sends a message already wrapped in a MessageNode. Non-blocking.
    * @param node the massage node to send.
    */
   void send(MessageNode<T>* node)
   {
-    lifo.push(node);
+    push(node, node);
   }
 
   /**
@@ -216,7 +435,7 @@ public:
  */
   void sendMultiple(MessageNode<T>* head)
   {
-    lifo.push_multiple(head, head->last());
+    push(head, head->last());
   }
 
   /**
@@ -240,7 +459,7 @@ public:
         storage.push_multiple(next, next->last());
       }
     }
-    lifo.push(node);
+    push(node, node);
     return fromStorage;
   }
 
@@ -264,7 +483,7 @@ public:
         storage.push_multiple(next, next->last());
       }
     }
-    lifo.push(node);
+    push(node, node);
     return true;
   }
 
@@ -317,6 +536,14 @@ public:
     return lifo.pop_all();
   }
 
+  /**
+   * @return true if there were no messages at the time of the call, false otherwise.
+   */
+  bool empty() const
+  {
+    return lifo.empty();
+  }
+
   /**
    * @return all the preallocated message nodes that are kept in storage.
    */
@@ -424,10 +651,13 @@ public:
  * @param action the functor to call on the received nodes
  * @return the number of handled messages
  */
-template<typename T, class Action>
-inline int receiveAndHandleMessageStack(Messenger<T>& messenger, Action action)
+template<typename T, Producers producers, Consumers consumers, class Action>
+inline int receiveAndHandleMessageStack(Messenger<T, producers, consumers>& messenger, Action action)
 {
   auto messages = messenger.receiveAllNodes();
+  if (!messages) {
+    return 0;
+  }
   auto numMessages = messages->count();
   handleMessageStack(messages, action);
   messenger.recycle(messages);
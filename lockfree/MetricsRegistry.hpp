@@ -0,0 +1,429 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "QueueWorld/QwConfig.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace lockfree {
+
+/**
+ * A registry of counters, gauges and histograms that can be updated from many real-time threads and read by a
+ * monitoring thread. Each thread registers its own slot, padded to the cache line size, and updates the values in it
+ * with plain loads and stores, without any read-modify-write operation, so the threads never contend on a counter.
+ * Readers aggregate the values across the slots.
+ * Metrics are added and threads are registered from non real-time threads, and updating the metrics through a
+ * ThreadSlot is wait-free. The values of a histogram are not read atomically as a whole, so a reading that happens
+ * while the histogram is being updated can be off by one record.
+ */
+class MetricsRegistry final
+{
+  static constexpr int valuesPerLine = static_cast<int>(CACHE_LINE_SIZE / sizeof(uint64_t));
+
+  struct alignas(CACHE_LINE_SIZE) CacheLine
+  {
+    std::atomic<uint64_t> values[valuesPerLine]{};
+  };
+
+public:
+  /**
+   * How the values of a gauge set by different threads are aggregated.
+   */
+  enum class GaugeAggregation
+  {
+    sum,
+    max
+  };
+
+  /**
+   * A handle to a counter.
+   */
+  struct Counter
+  {
+    int index;
+  };
+
+  /**
+   * A handle to a gauge.
+   */
+  struct Gauge
+  {
+    int index;
+  };
+
+  /**
+   * A handle to a histogram.
+   */
+  struct Histogram
+  {
+    int index;
+    double const* bounds;
+    int numBounds;
+  };
+
+  /**
+   * The values of a histogram, aggregated across the slots.
+   */
+  struct HistogramValues
+  {
+    // the number of records in each bucket, the last one holding the records above the last bound
+    std::vector<uint64_t> bucketCounts;
+    double sum{ 0.0 };
+    uint64_t count{ 0 };
+  };
+
+  /**
+   * The slot a thread updates the metrics through. It must be used by only one thread at a time.
+   */
+  class ThreadSlot final
+  {
+  public:
+    /**
+     * Adds to a counter. Wait-free.
+     * @param counter the counter
+     * @param amount the amount to add
+     */
+    void add(Counter counter, uint64_t amount = 1)
+    {
+      auto& value = getValue(counter.index);
+      value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets the value of a gauge for this thread. Wait-free.
+     * @param gauge the gauge
+     * @param value the value to set
+     */
+    void set(Gauge gauge, double value)
+    {
+      storeDouble(getValue(gauge.index), value);
+    }
+
+    /**
+     * Records a value in a histogram. Wait-free.
+     * @param histogram the histogram
+     * @param value the value to record
+     */
+    void record(Histogram histogram, double value)
+    {
+      auto const bucket =
+        static_cast<int>(std::lower_bound(histogram.bounds, histogram.bounds + histogram.numBounds, value) -
+                         histogram.bounds);
+      auto& bucketCount = getValue(histogram.index + bucket);
+      bucketCount.store(bucketCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      auto& sum = getValue(histogram.index + histogram.numBounds + 1);
+      storeDouble(sum, loadDouble(sum) + value);
+      auto& count = getValue(histogram.index + histogram.numBounds + 2);
+      count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+  private:
+    friend class MetricsRegistry;
+
+    explicit ThreadSlot(CacheLine* lines)
+      : lines{ lines }
+    {}
+
+    std::atomic<uint64_t>& getValue(int index)
+    {
+      return lines[index / valuesPerLine].values[index % valuesPerLine];
+    }
+
+    CacheLine* lines;
+  };
+
+  /**
+   * Constructor.
+   * @param maxNumThreads the maximum number of threads that can register a slot
+   * @param maxNumValues the maximum number of values in a slot. A counter or a gauge takes one value, a histogram takes
+   * its number of bounds plus three.
+   */
+  explicit MetricsRegistry(int maxNumThreads, int maxNumValues = 256)
+    : maxNumThreads{ maxNumThreads }
+    , maxNumValues{ maxNumValues }
+    , linesPerSlot{ (maxNumValues + valuesPerLine - 1) / valuesPerLine }
+    , lines{ new CacheLine[static_cast<size_t>(maxNumThreads) * static_cast<size_t>(linesPerSlot)] }
+  {}
+
+  /**
+   * Adds a counter.
+   * @param name the name of the counter
+   * @return the counter, or nothing if there is not enough room in the slots
+   */
+  std::optional<Counter> addCounter(std::string name)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    auto const index = addMetric(Metric::Type::counter, std::move(name), 1);
+    if (!index) {
+      return std::nullopt;
+    }
+    return Counter{ *index };
+  }
+
+  /**
+   * Adds a gauge.
+   * @param name the name of the gauge
+   * @param aggregation how the values set by different threads are aggregated
+   * @return the gauge, or nothing if there is not enough room in the slots
+   */
+  std::optional<Gauge> addGauge(std::string name, GaugeAggregation aggregation = GaugeAggregation::sum)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    auto const index = addMetric(Metric::Type::gauge, std::move(name), 1);
+    if (!index) {
+      return std::nullopt;
+    }
+    metrics.back()->aggregation = aggregation;
+    if (aggregation == GaugeAggregation::max) {
+      // so that the threads that never set the gauge do not count
+      for (int slot = 0; slot < maxNumThreads; ++slot) {
+        storeDouble(getValue(slot, *index), -std::numeric_limits<double>::infinity());
+      }
+    }
+    return Gauge{ *index };
+  }
+
+  /**
+   * Adds a histogram.
+   * @param name the name of the histogram
+   * @param bounds the upper bounds of the buckets, in ascending order. Values above the last bound go in an additional
+   * bucket.
+   * @return the histogram, or nothing if there is not enough room in the slots
+   */
+  std::optional<Histogram> addHistogram(std::string name, std::vector<double> bounds)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    auto const numBounds = static_cast<int>(bounds.size());
+    auto const index = addMetric(Metric::Type::histogram, std::move(name), numBounds + 3);
+    if (!index) {
+      return std::nullopt;
+    }
+    auto& metric = *metrics.back();
+    metric.bounds = std::move(bounds);
+    std::sort(metric.bounds.begin(), metric.bounds.end());
+    return Histogram{ *index, metric.bounds.data(), numBounds };
+  }
+
+  /**
+   * Registers a slot for the calling thread, or any other single thread.
+   * @return the slot, or nothing if all the slots have been registered
+   */
+  std::optional<ThreadSlot> registerThread()
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    if (numSlots == maxNumThreads) {
+      return std::nullopt;
+    }
+    auto const slot = numSlots++;
+    return ThreadSlot{ &lines[static_cast<size_t>(slot) * static_cast<size_t>(linesPerSlot)] };
+  }
+
+  /**
+   * @return the value of a counter, summed across the slots
+   */
+  uint64_t read(Counter counter)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    return sumValues(counter.index);
+  }
+
+  /**
+   * @return the value of a gauge, aggregated across the slots
+   */
+  double read(Gauge gauge)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    return aggregateGauge(gauge.index, findMetric(gauge.index).aggregation);
+  }
+
+  /**
+   * @return the values of a histogram, summed across the slots
+   */
+  HistogramValues read(Histogram histogram)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    return readHistogram(histogram.index, histogram.numBounds);
+  }
+
+  /**
+   * Exports all the metrics in the Prometheus text format, with cumulative histogram buckets.
+   * @return the text
+   */
+  std::string exportText()
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    auto text = std::ostringstream();
+    for (auto& metric : metrics) {
+      auto const& name = metric->name;
+      switch (metric->type) {
+        case Metric::Type::counter:
+          text << "# TYPE " << name << " counter\n" << name << " " << sumValues(metric->index) << "\n";
+          break;
+        case Metric::Type::gauge:
+          text << "# TYPE " << name << " gauge\n"
+               << name << " " << aggregateGauge(metric->index, metric->aggregation) << "\n";
+          break;
+        case Metric::Type::histogram: {
+          auto const numBounds = static_cast<int>(metric->bounds.size());
+          auto const values = readHistogram(metric->index, numBounds);
+          text << "# TYPE " << name << " histogram\n";
+          uint64_t cumulativeCount = 0;
+          for (int bucket = 0; bucket <= numBounds; ++bucket) {
+            cumulativeCount += values.bucketCounts[bucket];
+            text << name << "_bucket{le=\"";
+            if (bucket < numBounds) {
+              text << metric->bounds[bucket];
+            }
+            else {
+              text << "+Inf";
+            }
+            text << "\"} " << cumulativeCount << "\n";
+          }
+          text << name << "_sum " << values.sum << "\n" << name << "_count " << values.count << "\n";
+          break;
+        }
+      }
+    }
+    return text.str();
+  }
+
+  MetricsRegistry(MetricsRegistry const&) = delete;
+  MetricsRegistry& operator=(MetricsRegistry const&) = delete;
+
+private:
+  struct Metric
+  {
+    enum class Type
+    {
+      counter,
+      gauge,
+      histogram
+    };
+
+    Metric(Type type, std::string name, int index)
+      : type(type)
+      , name(std::move(name))
+      , index(index)
+    {}
+
+    Type type;
+    std::string name;
+    int index;
+    GaugeAggregation aggregation{ GaugeAggregation::sum };
+    std::vector<double> bounds;
+  };
+
+  static double loadDouble(std::atomic<uint64_t> const& value)
+  {
+    auto const bits = value.load(std::memory_order_relaxed);
+    double result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+  }
+
+  static void storeDouble(std::atomic<uint64_t>& value, double newValue)
+  {
+    uint64_t bits;
+    std::memcpy(&bits, &newValue, sizeof(bits));
+    value.store(bits, std::memory_order_relaxed);
+  }
+
+  std::optional<int> addMetric(Metric::Type type, std::string name, int numValues)
+  {
+    if (numUsedValues + numValues > maxNumValues) {
+      return std::nullopt;
+    }
+    auto const index = numUsedValues;
+    numUsedValues += numValues;
+    metrics.push_back(std::unique_ptr<Metric>(new Metric(type, std::move(name), index)));
+    return index;
+  }
+
+  Metric const& findMetric(int index) const
+  {
+    return **std::find_if(metrics.begin(), metrics.end(), [=](auto const& metric) { return metric->index == index; });
+  }
+
+  std::atomic<uint64_t>& getValue(int slot, int index)
+  {
+    auto& line = lines[static_cast<size_t>(slot) * static_cast<size_t>(linesPerSlot) + index / valuesPerLine];
+    return line.values[index % valuesPerLine];
+  }
+
+  uint64_t sumValues(int index)
+  {
+    uint64_t sum = 0;
+    for (int slot = 0; slot < numSlots; ++slot) {
+      sum += getValue(slot, index).load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+  double aggregateGauge(int index, GaugeAggregation aggregation)
+  {
+    if (aggregation == GaugeAggregation::sum) {
+      double sum = 0.0;
+      for (int slot = 0; slot < numSlots; ++slot) {
+        sum += loadDouble(getValue(slot, index));
+      }
+      return sum;
+    }
+    auto max = -std::numeric_limits<double>::infinity();
+    for (int slot = 0; slot < numSlots; ++slot) {
+      max = std::max(max, loadDouble(getValue(slot, index)));
+    }
+    return max == -std::numeric_limits<double>::infinity() ? 0.0 : max;
+  }
+
+  HistogramValues readHistogram(int index, int numBounds)
+  {
+    auto values = HistogramValues{ std::vector<uint64_t>(static_cast<size_t>(numBounds) + 1, 0) };
+    for (int slot = 0; slot < numSlots; ++slot) {
+      for (int bucket = 0; bucket <= numBounds; ++bucket) {
+        values.bucketCounts[bucket] += getValue(slot, index + bucket).load(std::memory_order_relaxed);
+      }
+      values.sum += loadDouble(getValue(slot, index + numBounds + 1));
+      values.count += getValue(slot, index + numBounds + 2).load(std::memory_order_relaxed);
+    }
+    return values;
+  }
+
+  int const maxNumThreads;
+  int const maxNumValues;
+  int const linesPerSlot;
+  std::unique_ptr<CacheLine[]> lines;
+  std::vector<std::unique_ptr<Metric>> metrics;
+  int numUsedValues{ 0 };
+  int numSlots{ 0 };
+  std::mutex mutex;
+};
+
+} // namespace lockfree
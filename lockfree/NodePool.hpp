@@ -0,0 +1,264 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "Messenger.hpp"
+#include "QueueWorld/QwConfig.h"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace lockfree {
+
+/**
+ * A lock-free pool of MessageNodes from which several threads can take single nodes concurrently, for example to send
+ * them through a Messenger shared by several real-time threads. Taking a node from the storage of a Messenger pops the
+ * whole storage and pushes back the nodes that were not needed, so the other threads may find it empty in the
+ * meantime. Taking a node from a NodePool never makes the other nodes unavailable.
+ * The nodes live in an arena of chunks that are only freed with the pool, and the list of the free nodes refers to
+ * them by 32 bit indices tagged with 32 bit counters, as the FifoMessenger does: a thread that is taking a node may
+ * read the link of a node that another thread has just taken, but never freed memory, and the nodes are recycled
+ * without ABA problems. Each chunk is twice as big as the previous one, so the pool can grow to maxNumNodes nodes
+ * with a fixed table of chunks.
+ * The nodes taken from a pool must be given back with recycle, never freed nor recycled into a Messenger, and they must
+ * not be left in a Messenger that is destroyed, as it would free them.
+ * @tparam T the type of the data held by the nodes, which must be default constructible
+ */
+template<typename T>
+class NodePool final
+{
+  static constexpr uint32_t nullIndex = 0;
+  static constexpr uint32_t firstChunkSize = 64;
+  static constexpr int maxNumChunks = 26;
+
+  static uint32_t getChunkSize(int chunk)
+  {
+    return firstChunkSize << chunk;
+  }
+
+  // the 0-based position of the first node of a chunk
+  static uint32_t getChunkBegin(int chunk)
+  {
+    return firstChunkSize * ((uint32_t{ 1 } << chunk) - 1);
+  }
+
+  static uint32_t untag(uint64_t tagged)
+  {
+    return static_cast<uint32_t>(tagged);
+  }
+
+  static uint64_t makeTagged(uint32_t index, uint64_t prevTagged)
+  {
+    return ((prevTagged >> 32) + 1) << 32 | index;
+  }
+
+public:
+  /**
+   * The maximum number of nodes a pool can hold, so that their indices fit in 32 bits.
+   */
+  static constexpr uint32_t maxNumNodes = firstChunkSize * ((uint32_t{ 1 } << maxNumChunks) - 1);
+
+  /**
+   * Constructor.
+   * @param numNodesToPreallocate the number of nodes to allocate
+   */
+  explicit NodePool(int numNodesToPreallocate = 0)
+  {
+    allocateNodes(numNodesToPreallocate);
+  }
+
+  /**
+   * Takes a single node from the pool, leaving the others available to the other threads. Lock-free.
+   * @return the node, whose next link is nullptr, or nullptr if the pool is empty
+   */
+  MessageNode<T>* pop()
+  {
+    auto topTagged = freeTop.load(std::memory_order_acquire);
+    while (untag(topTagged) != nullIndex) {
+      auto const nextFree = getNextFree(untag(topTagged)).load(std::memory_order_relaxed);
+      if (freeTop.compare_exchange_weak(topTagged, makeTagged(nextFree, topTagged), std::memory_order_acq_rel)) {
+        auto& node = getNode(untag(topTagged));
+        node.next() = nullptr;
+        return &node;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Takes a single node from the pool, or allocates a new one if the pool is empty, in which case it locks a mutex.
+   * As any allocation, it throws std::bad_alloc if it fails, which includes the pool already holding maxNumNodes nodes.
+   * @return the node, whose next link is nullptr
+   */
+  MessageNode<T>* popOrAllocate()
+  {
+    if (auto const node = pop()) {
+      return node;
+    }
+    auto const index = allocateNode();
+    if (index == nullIndex) {
+      throw std::bad_alloc();
+    }
+    return &getNode(index);
+  }
+
+  /**
+   * Gives back a stack of nodes taken from the pool. Lock-free.
+   * @param stack the stack of nodes, linked by MessageNode::next
+   */
+  void recycle(MessageNode<T>* stack)
+  {
+    if (!stack) {
+      return;
+    }
+    auto const front = getIndex(stack);
+    auto back = front;
+    for (auto node = stack->next(); node; node = node->next()) {
+      auto const index = getIndex(node);
+      getNextFree(back).store(index, std::memory_order_relaxed);
+      back = index;
+    }
+    pushFreeNodes(front, back);
+  }
+
+  /**
+   * Allocates nodes and puts them into the pool. It locks a mutex.
+   * @param numNodesToAllocate the number of nodes to allocate
+   * @return the number of nodes allocated, which is less than requested only if the pool has reached maxNumNodes
+   */
+  int allocateNodes(int numNodesToAllocate)
+  {
+    for (int i = 0; i < numNodesToAllocate; ++i) {
+      auto const index = allocateNode();
+      if (index == nullIndex) {
+        return i;
+      }
+      pushFreeNodes(index, index);
+    }
+    return numNodesToAllocate;
+  }
+
+  /**
+   * @return the number of nodes allocated by the pool, including the ones that have been taken from it
+   */
+  uint32_t getNumNodes() const
+  {
+    return numAllocatedNodes.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Destructor. It frees all the nodes, including the ones that have been taken from the pool.
+   */
+  ~NodePool()
+  {
+    for (int chunk = 0; chunk < numChunks; ++chunk) {
+      auto const nodes = nodeChunks[chunk].load(std::memory_order_relaxed);
+      for (uint32_t i = 0; i < getChunkSize(chunk); ++i) {
+        nodes[i].~MessageNode<T>();
+      }
+      std::allocator<MessageNode<T>>().deallocate(nodes, getChunkSize(chunk));
+      delete[] linkChunks[chunk].load(std::memory_order_relaxed);
+    }
+  }
+
+  NodePool(NodePool const&) = delete;
+  NodePool& operator=(NodePool const&) = delete;
+
+private:
+  int getChunk(uint32_t position) const
+  {
+    int chunk = 0;
+    while (position >= getChunkBegin(chunk + 1)) {
+      ++chunk;
+    }
+    return chunk;
+  }
+
+  MessageNode<T>& getNode(uint32_t index) const
+  {
+    auto const chunk = getChunk(index - 1);
+    return nodeChunks[chunk].load(std::memory_order_acquire)[index - 1 - getChunkBegin(chunk)];
+  }
+
+  std::atomic<uint32_t>& getNextFree(uint32_t index) const
+  {
+    auto const chunk = getChunk(index - 1);
+    return linkChunks[chunk].load(std::memory_order_acquire)[index - 1 - getChunkBegin(chunk)];
+  }
+
+  uint32_t getIndex(MessageNode<T> const* node) const
+  {
+    auto const less = std::less<MessageNode<T> const*>();
+    for (int chunk = 0; chunk < maxNumChunks; ++chunk) {
+      auto const nodes = nodeChunks[chunk].load(std::memory_order_acquire);
+      if (!nodes) {
+        break;
+      }
+      if (!less(node, nodes) && less(node, nodes + getChunkSize(chunk))) {
+        return getChunkBegin(chunk) + static_cast<uint32_t>(node - nodes) + 1;
+      }
+    }
+    assert(false && "the node does not belong to the NodePool");
+    return nullIndex;
+  }
+
+  uint32_t allocateNode()
+  {
+    auto const lock = std::lock_guard<std::mutex>(allocationMutex);
+    auto const position = numAllocatedNodes.load(std::memory_order_relaxed);
+    if (position == maxNumNodes) {
+      return nullIndex;
+    }
+    if (position == getChunkBegin(numChunks)) {
+      auto const size = getChunkSize(numChunks);
+      auto const nodes = std::allocator<MessageNode<T>>().allocate(size);
+      for (uint32_t i = 0; i < size; ++i) {
+        new (nodes + i) MessageNode<T>(T{});
+      }
+      linkChunks[numChunks].store(new std::atomic<uint32_t>[size](), std::memory_order_release);
+      nodeChunks[numChunks].store(nodes, std::memory_order_release);
+      ++numChunks;
+    }
+    numAllocatedNodes.store(position + 1, std::memory_order_relaxed);
+    return position + 1;
+  }
+
+  void pushFreeNodes(uint32_t front, uint32_t back)
+  {
+    auto topTagged = freeTop.load(std::memory_order_relaxed);
+    do {
+      getNextFree(back).store(untag(topTagged), std::memory_order_relaxed);
+    } while (!freeTop.compare_exchange_weak(topTagged, makeTagged(front, topTagged), std::memory_order_acq_rel));
+  }
+
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> freeTop{ 0 };
+  std::atomic<MessageNode<T>*> nodeChunks[maxNumChunks]{};
+  std::atomic<std::atomic<uint32_t>*> linkChunks[maxNumChunks]{};
+  std::atomic<uint32_t> numAllocatedNodes{ 0 };
+  int numChunks{ 0 };
+  std::mutex allocationMutex;
+};
+
+} // namespace lockfree
@@ -0,0 +1,344 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace lockfree {
+
+/**
+ * An immutable map implemented as a hash array mapped trie (HAMT). Setting or erasing a key produces a new version of
+ * the map in O(log n), which shares with the previous version all the subtrees that were not changed, so copying a map
+ * costs O(1), and old versions stay valid and unchanged for as long as someone holds them.
+ * It is meant to be used as (part of) the ObjectSettings of an AsyncObject, so that the settings can be shared with
+ * other threads without copying them. The values can themselves be PersistentMaps, to build trees of settings.
+ * A PersistentMap can be read concurrently from any number of threads.
+ * @tparam Key the type of the keys
+ * @tparam Value the type of the values
+ * @tparam Hash the hash functor for the keys
+ * @tparam KeyEqual the equality functor for the keys
+ */
+template<class Key, class Value, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+class PersistentMap final
+{
+  static constexpr int bitsPerLevel = 5;
+  static constexpr int maxDepth = (static_cast<int>(sizeof(size_t)) * 8 + bitsPerLevel - 1) / bitsPerLevel;
+
+  struct Leaf
+  {
+    Key key;
+    Value value;
+  };
+
+  struct Node;
+  using NodePtr = std::shared_ptr<Node const>;
+  using LeafPtr = std::shared_ptr<Leaf const>;
+
+  // exactly one of the two is set
+  struct Slot
+  {
+    LeafPtr leaf;
+    NodePtr node;
+  };
+
+  struct Node
+  {
+    // which of the 32 possible slots are in use
+    uint32_t bitmap{ 0 };
+    // the slots in use, in order of index
+    std::vector<Slot> slots;
+    // used instead of the slots when the nodes run out of hash bits, which only happens for colliding hashes
+    std::vector<LeafPtr> collisions;
+  };
+
+public:
+  /**
+   * Constructs an empty map.
+   */
+  PersistentMap() = default;
+
+  /**
+   * @return a pointer to the value associated with the key, or nullptr if there is none. The pointer is valid for as
+   * long as this version of the map (or any other version sharing the value) exists.
+   */
+  Value const* find(Key const& key) const
+  {
+    auto const hash = Hash{}(key);
+    auto node = root.get();
+    for (int depth = 0; node; ++depth) {
+      if (depth == maxDepth) {
+        for (auto& leaf : node->collisions) {
+          if (KeyEqual{}(leaf->key, key)) {
+            return &leaf->value;
+          }
+        }
+        return nullptr;
+      }
+      auto const bit = getBit(hash, depth);
+      if (!(node->bitmap & bit)) {
+        return nullptr;
+      }
+      auto& slot = node->slots[getPosition(node->bitmap, bit)];
+      if (slot.leaf) {
+        return KeyEqual{}(slot.leaf->key, key) ? &slot.leaf->value : nullptr;
+      }
+      node = slot.node.get();
+    }
+    return nullptr;
+  }
+
+  /**
+   * @return true if the map holds the key, false otherwise
+   */
+  bool contains(Key const& key) const
+  {
+    return find(key) != nullptr;
+  }
+
+  /**
+   * @return a new version of the map, in which the key is associated with the value.
+   */
+  PersistentMap set(Key key, Value value) const
+  {
+    auto const hash = Hash{}(key);
+    bool isNewKey = false;
+    auto leaf = std::make_shared<Leaf const>(Leaf{ std::move(key), std::move(value) });
+    auto newRoot = insert(root, 0, hash, std::move(leaf), isNewKey);
+    return PersistentMap(std::move(newRoot), isNewKey ? numEntries + 1 : numEntries);
+  }
+
+  /**
+   * @return a new version of the map, in which the value associated with the key is replaced by the result of the
+   * functor, which is called with the current value, or with a default constructed one if there is none. Useful to
+   * change the values of nested maps.
+   */
+  template<class Updater>
+  PersistentMap update(Key const& key, Updater&& updater) const
+  {
+    auto const current = find(key);
+    return set(key, current ? updater(*current) : updater(Value{}));
+  }
+
+  /**
+   * @return a new version of the map, without the key.
+   */
+  PersistentMap erase(Key const& key) const
+  {
+    if (!root) {
+      return *this;
+    }
+    bool isErased = false;
+    auto newRoot = remove(root, 0, Hash{}(key), key, isErased);
+    if (!isErased) {
+      return *this;
+    }
+    return PersistentMap(std::move(newRoot), numEntries - 1);
+  }
+
+  /**
+   * Calls a functor on each key and value of the map, in no particular order.
+   * @param action the functor, with signature void(Key const&, Value const&)
+   */
+  template<class Action>
+  void forEach(Action&& action) const
+  {
+    if (root) {
+      forEach(*root, action);
+    }
+  }
+
+  /**
+   * @return the number of keys in the map
+   */
+  size_t size() const
+  {
+    return numEntries;
+  }
+
+  /**
+   * @return true if the map is empty
+   */
+  bool empty() const
+  {
+    return numEntries == 0;
+  }
+
+  /**
+   * @return true if the two maps are the same version, or versions with the same content that share all of it. It is
+   * O(1) and can return false for maps with equal content that do not share it.
+   */
+  bool isSameVersion(PersistentMap const& other) const
+  {
+    return root == other.root;
+  }
+
+private:
+  PersistentMap(NodePtr root, size_t numEntries)
+    : root{ std::move(root) }
+    , numEntries{ numEntries }
+  {}
+
+  static uint32_t getBit(size_t hash, int depth)
+  {
+    return uint32_t{ 1 } << ((hash >> (depth * bitsPerLevel)) & 31);
+  }
+
+  static int getPosition(uint32_t bitmap, uint32_t bit)
+  {
+    // population count of the bits below the bit of the slot
+    uint32_t x = bitmap & (bit - 1);
+    x = x - ((x >> 1) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+    x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+    return static_cast<int>((x * 0x01010101u) >> 24);
+  }
+
+  static NodePtr insert(NodePtr const& node, int depth, size_t hash, LeafPtr leaf, bool& isNewKey)
+  {
+    auto newNode = node ? std::make_shared<Node>(*node) : std::make_shared<Node>();
+    if (depth == maxDepth) {
+      auto it = std::find_if(newNode->collisions.begin(), newNode->collisions.end(), [&](LeafPtr const& collision) {
+        return KeyEqual{}(collision->key, leaf->key);
+      });
+      if (it != newNode->collisions.end()) {
+        *it = std::move(leaf);
+      }
+      else {
+        newNode->collisions.push_back(std::move(leaf));
+        isNewKey = true;
+      }
+      return newNode;
+    }
+    auto const bit = getBit(hash, depth);
+    auto const position = getPosition(newNode->bitmap, bit);
+    if (!(newNode->bitmap & bit)) {
+      newNode->bitmap |= bit;
+      newNode->slots.insert(newNode->slots.begin() + position, Slot{ std::move(leaf), nullptr });
+      isNewKey = true;
+      return newNode;
+    }
+    auto& slot = newNode->slots[position];
+    if (slot.node) {
+      slot.node = insert(slot.node, depth + 1, hash, std::move(leaf), isNewKey);
+    }
+    else if (KeyEqual{}(slot.leaf->key, leaf->key)) {
+      slot.leaf = std::move(leaf);
+    }
+    else {
+      // two keys share this slot, so they are moved one level down
+      bool unused = false;
+      auto const otherHash = Hash{}(slot.leaf->key);
+      auto subNode = insert(nullptr, depth + 1, otherHash, std::move(slot.leaf), unused);
+      slot.node = insert(subNode, depth + 1, hash, std::move(leaf), isNewKey);
+      slot.leaf = nullptr;
+    }
+    return newNode;
+  }
+
+  static NodePtr remove(NodePtr const& node, int depth, size_t hash, Key const& key, bool& isErased)
+  {
+    if (depth == maxDepth) {
+      auto it = std::find_if(node->collisions.begin(), node->collisions.end(), [&](LeafPtr const& collision) {
+        return KeyEqual{}(collision->key, key);
+      });
+      if (it == node->collisions.end()) {
+        return node;
+      }
+      isErased = true;
+      if (node->collisions.size() == 1) {
+        return nullptr;
+      }
+      auto newNode = std::make_shared<Node>(*node);
+      newNode->collisions.erase(newNode->collisions.begin() + (it - node->collisions.begin()));
+      return newNode;
+    }
+    auto const bit = getBit(hash, depth);
+    if (!(node->bitmap & bit)) {
+      return node;
+    }
+    auto const position = getPosition(node->bitmap, bit);
+    auto& slot = node->slots[position];
+    if (slot.leaf) {
+      if (!KeyEqual{}(slot.leaf->key, key)) {
+        return node;
+      }
+      isErased = true;
+      if (node->slots.size() == 1) {
+        return nullptr;
+      }
+      auto newNode = std::make_shared<Node>(*node);
+      newNode->bitmap &= ~bit;
+      newNode->slots.erase(newNode->slots.begin() + position);
+      return newNode;
+    }
+    auto newSubNode = remove(slot.node, depth + 1, hash, key, isErased);
+    if (!isErased) {
+      return node;
+    }
+    auto newNode = std::make_shared<Node>(*node);
+    auto& newSlot = newNode->slots[position];
+    if (!newSubNode) {
+      newNode->bitmap &= ~bit;
+      newNode->slots.erase(newNode->slots.begin() + position);
+      if (newNode->slots.empty()) {
+        return nullptr;
+      }
+    }
+    else if (newSubNode->slots.size() == 1 && newSubNode->slots[0].leaf) {
+      // a subtree holding a single key is collapsed back into this node
+      newSlot.leaf = newSubNode->slots[0].leaf;
+      newSlot.node = nullptr;
+    }
+    else if (newSubNode->collisions.size() == 1) {
+      newSlot.leaf = newSubNode->collisions[0];
+      newSlot.node = nullptr;
+    }
+    else {
+      newSlot.node = std::move(newSubNode);
+    }
+    return newNode;
+  }
+
+  template<class Action>
+  static void forEach(Node const& node, Action& action)
+  {
+    for (auto& leaf : node.collisions) {
+      action(leaf->key, leaf->value);
+    }
+    for (auto& slot : node.slots) {
+      if (slot.leaf) {
+        action(slot.leaf->key, slot.leaf->value);
+      }
+      else {
+        forEach(*slot.node, action);
+      }
+    }
+  }
+
+  NodePtr root;
+  size_t numEntries{ 0 };
+};
+
+} // namespace lockfree
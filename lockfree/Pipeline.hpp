@@ -0,0 +1,312 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "AsyncObjectInterface.hpp"
+#include "Messenger.hpp"
+#include "NodePool.hpp"
+#include "QueueWorld/QwConfig.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace lockfree {
+
+/**
+ * A chain of processing stages, each running on its own thread, through which messages flow from any number of
+ * source threads. The messages live in preallocated nodes that are moved from one stage to the next, so the payloads
+ * are never copied, and after the last stage the nodes go back to the NodePool they were taken from, from which
+ * several source threads can take nodes concurrently.
+ * Each stage takes its messages from a bounded channel: a stage waits for the next one to have room before passing
+ * a message on, and pushing a message into the pipeline fails if there is no node available or if the first stage is
+ * full. Pushing is lock-free and does not allocate, so it can be done from a real-time thread.
+ * Idle stages sleep for at most maxIdleWait, as a real-time thread cannot wake them up.
+ * The messages that are still in the pipeline when it is destroyed are discarded.
+ * @tparam T the type of the messages, which must be default constructible
+ */
+template<class T>
+class Pipeline final
+{
+public:
+  /**
+   * Statistics of a stage. The times are in nanoseconds.
+   */
+  struct StageStats
+  {
+    // the number of messages processed by the stage
+    int64_t numProcessed{ 0 };
+    // the time the messages spent in the channel of the stage
+    int64_t totalWaitTime{ 0 };
+    int64_t maxWaitTime{ 0 };
+    // the time the stage spent processing the messages
+    int64_t totalProcessingTime{ 0 };
+    int64_t maxProcessingTime{ 0 };
+    // the number of times the stage had to wait for the next one to have room in its channel
+    int64_t numBackpressureStalls{ 0 };
+  };
+
+  /**
+   * Constructor.
+   * @param numNodes the number of nodes, which is the maximum number of messages in the pipeline at the same time
+   * @param maxIdleWait the maximum time an idle stage sleeps before looking for messages again
+   */
+  explicit Pipeline(int numNodes, std::chrono::microseconds maxIdleWait = std::chrono::microseconds(200))
+    : maxIdleWait{ maxIdleWait }
+  {
+    pool.allocateNodes(numNodes);
+  }
+
+  /**
+   * Adds a stage at the end of the pipeline. It must be called before start.
+   * @param process the function that processes the messages, with signature void(T& message), called on the thread
+   * of the stage
+   * @param capacity the maximum number of messages waiting in the channel of the stage
+   * @return a reference to the pipeline, to chain the calls
+   */
+  Pipeline& addStage(std::function<void(T&)> process, int capacity)
+  {
+    stages.push_back(std::make_unique<Stage>(std::move(process), capacity));
+    return *this;
+  }
+
+  /**
+   * Starts the threads of the stages.
+   */
+  void start()
+  {
+    for (size_t i = 0; i < stages.size(); ++i) {
+      if (!stages[i]->thread.joinable()) {
+        stages[i]->thread = std::thread([this, i] { runStage(i); });
+      }
+    }
+  }
+
+  /**
+   * Takes a node from the pool, initializes its message, and sends it to the first stage. Lock-free, it does not
+   * allocate.
+   * @param initializer a functor with signature void(T& message), which is only called if the message is sent
+   * @return true if the message was sent, false if there was no node available or the first stage was full
+   */
+  template<class Initializer>
+  bool pushIfNodeAvailable(Initializer initializer)
+  {
+    if (stages.empty() || !stages.front()->reserve()) {
+      numRejectedPushes.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    auto node = pool.pop();
+    if (!node) {
+      stages.front()->numQueued.fetch_sub(1, std::memory_order_relaxed);
+      numRejectedPushes.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    initializer(node->get().payload);
+    node->get().sendTime = detail::getTimeInNanoseconds();
+    stages.front()->input.send(node);
+    return true;
+  }
+
+  /**
+   * @return the number of stages
+   */
+  int getNumStages() const
+  {
+    return static_cast<int>(stages.size());
+  }
+
+  /**
+   * @param stageIndex the index of the stage
+   * @return the statistics of the stage
+   */
+  StageStats getStageStats(int stageIndex) const
+  {
+    auto& counters = stages[stageIndex]->counters;
+    auto stats = StageStats{};
+    stats.numProcessed = counters.numProcessed.load(std::memory_order_relaxed);
+    stats.totalWaitTime = counters.totalWaitTime.load(std::memory_order_relaxed);
+    stats.maxWaitTime = counters.maxWaitTime.load(std::memory_order_relaxed);
+    stats.totalProcessingTime = counters.totalProcessingTime.load(std::memory_order_relaxed);
+    stats.maxProcessingTime = counters.maxProcessingTime.load(std::memory_order_relaxed);
+    stats.numBackpressureStalls = counters.numBackpressureStalls.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  /**
+   * @return the number of calls to pushIfNodeAvailable that failed
+   */
+  int64_t getNumRejectedPushes() const
+  {
+    return numRejectedPushes.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Destructor. It stops and joins the threads of the stages.
+   */
+  ~Pipeline()
+  {
+    stopFlag.store(true, std::memory_order_release);
+    for (auto& stage : stages) {
+      if (stage->thread.joinable()) {
+        stage->thread.join();
+      }
+    }
+    // the nodes belong to the pool, which frees them
+    for (auto& stage : stages) {
+      pool.recycle(stage->input.receiveAllNodes());
+    }
+  }
+
+  Pipeline(Pipeline const&) = delete;
+  Pipeline& operator=(Pipeline const&) = delete;
+
+private:
+  struct Item
+  {
+    T payload{};
+    // the time the message was sent to the channel it is in
+    int64_t sendTime{ 0 };
+  };
+
+  using ItemNode = MessageNode<Item>;
+
+  struct Counters
+  {
+    std::atomic<int64_t> numProcessed{ 0 };
+    std::atomic<int64_t> totalWaitTime{ 0 };
+    std::atomic<int64_t> maxWaitTime{ 0 };
+    std::atomic<int64_t> totalProcessingTime{ 0 };
+    std::atomic<int64_t> maxProcessingTime{ 0 };
+    std::atomic<int64_t> numBackpressureStalls{ 0 };
+  };
+
+  struct Stage
+  {
+    Stage(std::function<void(T&)> process, int capacity)
+      : process{ std::move(process) }
+      , capacity{ capacity }
+    {}
+
+    // reserves room for a message in the channel
+    bool reserve()
+    {
+      if (numQueued.fetch_add(1, std::memory_order_relaxed) >= capacity) {
+        numQueued.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+      }
+      return true;
+    }
+
+    alignas(CACHE_LINE_SIZE) Messenger<Item, Producers::multiple, Consumers::single> input;
+    alignas(CACHE_LINE_SIZE) std::atomic<int> numQueued{ 0 };
+    alignas(CACHE_LINE_SIZE) Counters counters;
+    std::function<void(T&)> process;
+    int const capacity;
+    std::thread thread;
+  };
+
+  static void updateMax(std::atomic<int64_t>& max, int64_t value)
+  {
+    // only the thread of the stage writes its counters
+    if (value > max.load(std::memory_order_relaxed)) {
+      max.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  static void add(std::atomic<int64_t>& total, int64_t value)
+  {
+    total.store(total.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  void runStage(size_t stageIndex)
+  {
+    auto& stage = *stages[stageIndex];
+    auto const nextStage = stageIndex + 1 < stages.size() ? stages[stageIndex + 1].get() : nullptr;
+    while (!stopFlag.load(std::memory_order_acquire)) {
+      auto node = stage.input.receiveAllNodes();
+      if (!node) {
+        std::this_thread::sleep_for(maxIdleWait);
+        continue;
+      }
+      // the head is the last message sent: reverse the stack to process them in order
+      ItemNode* oldest = nullptr;
+      while (node) {
+        auto const next = node->next();
+        node->next() = oldest;
+        oldest = node;
+        node = next;
+      }
+      while (oldest) {
+        node = oldest;
+        oldest = node->next();
+        node->next() = nullptr;
+        stage.numQueued.fetch_sub(1, std::memory_order_relaxed);
+        if (!processAndForward(stage, nextStage, node)) {
+          // stopped while waiting for the next stage
+          pool.recycle(node);
+          pool.recycle(oldest);
+          return;
+        }
+      }
+    }
+  }
+
+  bool processAndForward(Stage& stage, Stage* nextStage, ItemNode* node)
+  {
+    auto& item = node->get();
+    auto const startTime = detail::getTimeInNanoseconds();
+    stage.process(item.payload);
+    auto const endTime = detail::getTimeInNanoseconds();
+    auto& counters = stage.counters;
+    counters.numProcessed.store(counters.numProcessed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    add(counters.totalWaitTime, startTime - item.sendTime);
+    updateMax(counters.maxWaitTime, startTime - item.sendTime);
+    add(counters.totalProcessingTime, endTime - startTime);
+    updateMax(counters.maxProcessingTime, endTime - startTime);
+    if (!nextStage) {
+      pool.recycle(node);
+      return true;
+    }
+    if (!nextStage->reserve()) {
+      add(counters.numBackpressureStalls, 1);
+      do {
+        if (stopFlag.load(std::memory_order_acquire)) {
+          return false;
+        }
+        std::this_thread::yield();
+      } while (!nextStage->reserve());
+    }
+    item.sendTime = detail::getTimeInNanoseconds();
+    nextStage->input.send(node);
+    return true;
+  }
+
+  NodePool<Item> pool;
+  std::vector<std::unique_ptr<Stage>> stages;
+  std::atomic<int64_t> numRejectedPushes{ 0 };
+  std::atomic<bool> stopFlag{ false };
+  std::chrono::microseconds const maxIdleWait;
+};
+
+} // namespace lockfree
@@ -0,0 +1,281 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "AsyncObjectInterface.hpp"
+#include "Messenger.hpp"
+#include "NodePool.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+namespace lockfree {
+
+/**
+ * A logger that can be used from real-time threads. Logging does not format nor allocate: it stores the pointer to the
+ * format string, a timestamp and the arguments in a node taken from a preallocated NodePool, or counts the record as
+ * dropped if there is no node available. Several real-time threads can log at once without taking the free nodes
+ * from each other. The records are formatted and written to an output stream in batches when flush is called, either
+ * by a non real-time thread or by an AsyncThread the logger is attached to.
+ * The format string must outlive the logger, as string literals do, and "{}" in it is replaced by the next argument.
+ * The arguments can be arithmetic values, enums, pointers, and string literals.
+ * @tparam MaxNumArguments the maximum number of arguments of a record
+ */
+template<int MaxNumArguments = 4>
+class RealtimeLogger final : public detail::AsyncObjectInterface
+{
+public:
+  /**
+   * Creates a RealtimeLogger.
+   * @param output the stream to write the records to, which must outlive the logger
+   * @param numNodesToPreallocate the number of records that can be logged before flush is called without dropping
+   * @return the logger
+   */
+  static std::shared_ptr<RealtimeLogger> create(std::ostream& output, int numNodesToPreallocate)
+  {
+    auto logger = std::shared_ptr<RealtimeLogger>(new RealtimeLogger(output));
+    logger->pool.allocateNodes(numNodesToPreallocate);
+    return logger;
+  }
+
+  /**
+   * Logs a record. Lock-free, it does not allocate.
+   * @param format the format string, with a "{}" for each argument. It must outlive the logger.
+   * @param arguments the arguments
+   * @return true if the record was logged, false if it was dropped because there was no node available
+   */
+  template<class... Arguments>
+  bool log(char const* format, Arguments... arguments)
+  {
+    static_assert(sizeof...(Arguments) <= MaxNumArguments, "Too many arguments for the RealtimeLogger");
+    auto node = pool.pop();
+    if (!node) {
+      numDroppedRecords.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    node->get() =
+      Record{ format, detail::getTimeInNanoseconds(), sizeof...(Arguments), { makeArgument(arguments)... } };
+    messenger.send(node);
+    return true;
+  }
+
+  /**
+   * Formats and writes all the records logged so far, in the order they were logged, and a line reporting how many
+   * records have been dropped since the last flush, if any. It must not be called from a real-time thread.
+   * @return the number of records written
+   */
+  int flush()
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    buffer.str({});
+    auto const records = messenger.receiveAllNodes();
+    auto const numRecords = records ? records->count() : 0;
+    handleMessageStack(records, [this](Record const& record) { formatRecord(record); });
+    pool.recycle(records);
+    auto const numDropped = numDroppedRecords.load(std::memory_order_relaxed);
+    if (numDropped != numReportedDroppedRecords) {
+      buffer << "[RealtimeLogger] " << (numDropped - numReportedDroppedRecords) << " records dropped\n";
+      numReportedDroppedRecords = numDropped;
+    }
+    auto const text = buffer.str();
+    if (!text.empty()) {
+      output.write(text.data(), static_cast<std::streamsize>(text.size()));
+      output.flush();
+    }
+    return numRecords;
+  }
+
+  /**
+   * @return the number of records that have been dropped because there was no node available
+   */
+  uint64_t getNumDroppedRecords() const
+  {
+    return numDroppedRecords.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Preallocates nodes, so that more records can be logged before flush is called without dropping.
+   * @param numNodesToAllocate the number of nodes to allocate
+   */
+  void allocateNodes(int numNodesToAllocate)
+  {
+    pool.allocateNodes(numNodesToAllocate);
+  }
+
+  /**
+   * Destructor. The records that have not been flushed are discarded.
+   */
+  ~RealtimeLogger() override
+  {
+    pool.recycle(messenger.receiveAllNodes());
+  }
+
+private:
+  struct Argument
+  {
+    enum class Type
+    {
+      signedInteger,
+      unsignedInteger,
+      floatingPoint,
+      boolean,
+      character,
+      string,
+      pointer
+    };
+
+    Type type{ Type::signedInteger };
+    union
+    {
+      int64_t signedInteger;
+      uint64_t unsignedInteger;
+      double floatingPoint;
+      bool boolean;
+      char character;
+      char const* string;
+      void const* pointer;
+    };
+  };
+
+  struct Record
+  {
+    char const* format{ nullptr };
+    int64_t timestamp{ 0 };
+    int numArguments{ 0 };
+    Argument arguments[MaxNumArguments > 0 ? MaxNumArguments : 1]{};
+  };
+
+  static_assert(std::is_trivially_copyable_v<Record>, "Records must be trivially copyable");
+
+  template<class T>
+  static Argument makeArgument(T value)
+  {
+    Argument argument;
+    if constexpr (std::is_same_v<T, bool>) {
+      argument.type = Argument::Type::boolean;
+      argument.boolean = value;
+    }
+    else if constexpr (std::is_same_v<T, char>) {
+      argument.type = Argument::Type::character;
+      argument.character = value;
+    }
+    else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+      argument.type = Argument::Type::signedInteger;
+      argument.signedInteger = value;
+    }
+    else if constexpr (std::is_integral_v<T>) {
+      argument.type = Argument::Type::unsignedInteger;
+      argument.unsignedInteger = value;
+    }
+    else if constexpr (std::is_floating_point_v<T>) {
+      argument.type = Argument::Type::floatingPoint;
+      argument.floatingPoint = static_cast<double>(value);
+    }
+    else if constexpr (std::is_enum_v<T>) {
+      return makeArgument(static_cast<std::underlying_type_t<T>>(value));
+    }
+    else if constexpr (std::is_same_v<T, char const*> || std::is_same_v<T, char*>) {
+      argument.type = Argument::Type::string;
+      argument.string = value;
+    }
+    else {
+      static_assert(std::is_pointer_v<T>, "Unsupported argument type for the RealtimeLogger");
+      argument.type = Argument::Type::pointer;
+      argument.pointer = static_cast<void const*>(value);
+    }
+    return argument;
+  }
+
+  explicit RealtimeLogger(std::ostream& output)
+    : output{ output }
+    , startTime{ detail::getTimeInNanoseconds() }
+  {}
+
+  void formatArgument(Argument const& argument)
+  {
+    switch (argument.type) {
+      case Argument::Type::signedInteger:
+        buffer << argument.signedInteger;
+        break;
+      case Argument::Type::unsignedInteger:
+        buffer << argument.unsignedInteger;
+        break;
+      case Argument::Type::floatingPoint:
+        buffer << argument.floatingPoint;
+        break;
+      case Argument::Type::boolean:
+        buffer << (argument.boolean ? "true" : "false");
+        break;
+      case Argument::Type::character:
+        buffer << argument.character;
+        break;
+      case Argument::Type::string:
+        buffer << (argument.string ? argument.string : "(null)");
+        break;
+      case Argument::Type::pointer:
+        buffer << argument.pointer;
+        break;
+    }
+  }
+
+  void formatRecord(Record const& record)
+  {
+    auto const microseconds = (record.timestamp - startTime) / 1000;
+    buffer << '[' << microseconds / 1000000 << '.';
+    buffer.width(6);
+    buffer.fill('0');
+    buffer << microseconds % 1000000 << "] ";
+    int argumentIndex = 0;
+    for (auto it = record.format; *it; ++it) {
+      if (it[0] == '{' && it[1] == '}' && argumentIndex < record.numArguments) {
+        formatArgument(record.arguments[argumentIndex++]);
+        ++it;
+      }
+      else {
+        buffer << *it;
+      }
+    }
+    buffer << '\n';
+  }
+
+  bool timerCallback() override
+  {
+    flush();
+    // writing the records is not a change, and must not make an adaptive AsyncThread speed up
+    return false;
+  }
+
+  NodePool<Record> pool;
+  Messenger<Record> messenger;
+  std::atomic<uint64_t> numDroppedRecords{ 0 };
+  uint64_t numReportedDroppedRecords{ 0 };
+  std::ostream& output;
+  std::ostringstream buffer;
+  int64_t const startTime;
+  std::mutex mutex;
+};
+
+} // namespace lockfree
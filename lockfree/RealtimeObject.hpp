@@ -20,23 +20,31 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #pragma once
+#include "DeferredDeleter.hpp"
 #include "Messenger.hpp"
 #include <cassert>
 #include <mutex>
 
 namespace lockfree {
 
+class Transaction;
+
 /**
  * A wrapper to manage an object that needs to be used by one real-time thread, and that it is created and modified by
  * one or more non real-time threads.
+ * Once a RealtimeObject has been changed through a Transaction, it must only be changed through Transactions: set,
+ * change and changeIf would race with the bundles of the TransactionChannel, which do not go through the Messenger of
+ * the RealtimeObject. This is checked with assertions.
  * */
 template<class Object>
 class RealtimeObject final
 {
+  friend class Transaction;
+
 public:
   /**
    * Updates the object in use on the real-time thread to the last version produced. If such a version is received, the
-   * old version gets sent back to the non real-time thread to be freed. Lock-free.
+   * old version is handed to the DeferredDeleter to be freed on a non real-time thread. Lock-free.
    * @return a pointer to the object
    */
   Object* receiveChangesOnRealtimeThread()
@@ -44,7 +52,13 @@ public:
     auto head = messengerForNewObjects.receiveAllNodes();
     if (head) {
       std::swap(realtimeInstance, head->get());
-      messengerForOldObjects.sendMultiple(head);
+      head->last()->next() = oldObjects;
+      oldObjects = head;
+    }
+    if (oldObjects) {
+      // the objects that cannot be deferred now are kept until the next call
+      oldObjects = deleter->deferMessages(
+        oldObjects, messengerForNewObjects, [](std::unique_ptr<Object>& object) -> auto& { return object; });
     }
     return realtimeInstance.get();
   }
@@ -65,6 +79,7 @@ public:
   void change(std::function<std::unique_ptr<Object>(Object const&)> const& changer)
   {
     auto const lock = std::lock_guard<std::mutex>(mutex);
+    assert(!isChangedByTransactions && "a RealtimeObject changed by a Transaction must only be changed by those");
     auto objectPtr = getOnNonRealtimeThread();
     if (!objectPtr)
       return;
@@ -83,6 +98,7 @@ public:
                 std::function<bool(Object const&)> const& predicate)
   {
     auto const lock = std::lock_guard<std::mutex>(mutex);
+    assert(!isChangedByTransactions && "a RealtimeObject changed by a Transaction must only be changed by those");
     auto objectPtr = getOnNonRealtimeThread();
     if (!objectPtr)
       return false;
@@ -115,12 +131,13 @@ public:
 
   /**
    * Sets the object and it sends it to the real-time thread. Also frees any object that has been previously discarded
-   * from the real-time thread.
+   * from the real-time thread, unless the DeferredDeleter is shared.
    * @newObject the new version of the object
    */
   void set(std::unique_ptr<Object> newObject)
   {
     auto const lock = std::lock_guard<std::mutex>(mutex);
+    assert(!isChangedByTransactions && "a RealtimeObject changed by a Transaction must only be changed by those");
     lastObject = newObject.get();
     send(std::move(newObject));
   }
@@ -128,25 +145,47 @@ public:
   /**
    * Constructor.
    * @param object the object to hold
-   * @param numNodesToPreallocate the number of nodes to allocate.
+   * @param sharedDeleter the DeferredDeleter that frees the objects discarded by the real-time thread, which is
+   * collected by whoever shares it, for example an AsyncThread it is attached to. If nullptr, the RealtimeObject uses
+   * its own, which it collects when a new object is set.
    */
-  explicit RealtimeObject(std::unique_ptr<Object> object)
-    : realtimeInstance(std::move(object))
+  explicit RealtimeObject(std::unique_ptr<Object> object, std::shared_ptr<DeferredDeleter<>> sharedDeleter = nullptr)
+    : isDeleterShared(sharedDeleter != nullptr)
+    , deleter(sharedDeleter ? std::move(sharedDeleter) : DeferredDeleter<>::create(numDeleterNodes))
+    , realtimeInstance(std::move(object))
   {
     lastObject = realtimeInstance.get();
   }
 
+  /**
+   * Destructor.
+   */
+  ~RealtimeObject()
+  {
+    freeMessageStack(oldObjects);
+  }
+
 private:
   void send(std::unique_ptr<Object> newObject)
   {
-    messengerForOldObjects.discardAndFreeAllMessages();
+    if (!isDeleterShared) {
+      deleter->collect();
+    }
     messengerForNewObjects.send(std::move(newObject));
   }
 
-  lockfree::Messenger<std::unique_ptr<Object>> messengerForNewObjects;
-  lockfree::Messenger<std::unique_ptr<Object>> messengerForOldObjects;
+  static constexpr int numDeleterNodes = 4;
+
+  // new objects are only sent under the mutex, and only received by the real-time thread, which recycles the nodes
+  lockfree::Messenger<std::unique_ptr<Object>, Producers::single, Consumers::single> messengerForNewObjects;
+  bool const isDeleterShared;
+  std::shared_ptr<DeferredDeleter<>> deleter;
+  // the old objects that the real-time thread could not defer yet
+  MessageNode<std::unique_ptr<Object>>* oldObjects{ nullptr };
   std::unique_ptr<Object> realtimeInstance;
   Object* lastObject{ nullptr };
+  // set by the first Transaction committed, under the mutex
+  bool isChangedByTransactions{ false };
   std::mutex mutex;
 };
 
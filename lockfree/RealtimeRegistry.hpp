@@ -0,0 +1,344 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "QueueWorld/QwConfig.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace lockfree {
+
+/**
+ * A map from ids to shared objects, such as wavetables or impulse responses, for lookups from realtime threads.
+ * It is an open-addressing hash table with linear probing and a fixed capacity, whose entries are only written by the
+ * non-realtime threads that insert, replace and remove the objects.
+ * Each realtime thread registers a Reader, and looks up the objects within a ReadGuard: the guard publishes the epoch
+ * in which the reader is reading, and the objects that are replaced or removed are only destroyed by the writers when
+ * no reader that could still hold them remains, see collect. Looking up is wait-free and does not allocate.
+ * As removed entries leave a tombstone behind, the capacity bounds the number of distinct ids ever inserted.
+ * @tparam Value the type of the objects
+ */
+template<class Value>
+class RealtimeRegistry final
+{
+  struct alignas(CACHE_LINE_SIZE) ReaderSlot
+  {
+    // 0 if the reader is not reading
+    std::atomic<uint64_t> epoch{ 0 };
+    std::atomic<bool> isTaken{ false };
+  };
+
+  struct Entry
+  {
+    std::atomic<bool> isUsed{ false };
+    std::atomic<uint64_t> id{ 0 };
+    std::atomic<Value const*> value{ nullptr };
+  };
+
+public:
+  class Reader;
+
+  /**
+   * While a ReadGuard is alive, the objects found through it are not destroyed.
+   */
+  class ReadGuard final
+  {
+  public:
+    /**
+     * Looks up an object. Wait-free, it does not allocate.
+     * @param id the id of the object
+     * @return the object, valid as long as the guard, or nullptr if there is no object with the id
+     */
+    Value const* find(uint64_t id) const
+    {
+      return registry.find(id);
+    }
+
+    ~ReadGuard()
+    {
+      reader.unlock();
+    }
+
+    ReadGuard(ReadGuard const&) = delete;
+    ReadGuard& operator=(ReadGuard const&) = delete;
+
+  private:
+    friend class Reader;
+
+    ReadGuard(RealtimeRegistry const& registry, Reader& reader)
+      : registry{ registry }
+      , reader{ reader }
+    {}
+
+    RealtimeRegistry const& registry;
+    Reader& reader;
+  };
+
+  /**
+   * The handle through which a thread looks up the objects. It must be used by one thread at a time.
+   */
+  class Reader final
+  {
+  public:
+    /**
+     * Starts reading. Wait-free. Guards can be nested.
+     * @return the guard, which must not outlive the reader
+     */
+    ReadGuard read()
+    {
+      if (depth++ == 0) {
+        slot->epoch.store(registry->epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+      }
+      return ReadGuard{ *registry, *this };
+    }
+
+    Reader(Reader&& other) noexcept
+      : registry{ other.registry }
+      , slot{ other.slot }
+    {
+      other.slot = nullptr;
+    }
+
+    Reader& operator=(Reader&& other) noexcept
+    {
+      std::swap(registry, other.registry);
+      std::swap(slot, other.slot);
+      std::swap(depth, other.depth);
+      return *this;
+    }
+
+    /**
+     * Destructor. It makes the slot of the reader available again.
+     */
+    ~Reader()
+    {
+      if (slot) {
+        slot->isTaken.store(false, std::memory_order_release);
+      }
+    }
+
+    Reader(Reader const&) = delete;
+    Reader& operator=(Reader const&) = delete;
+
+  private:
+    friend class RealtimeRegistry;
+    friend class ReadGuard;
+
+    Reader(RealtimeRegistry const* registry, ReaderSlot* slot)
+      : registry{ registry }
+      , slot{ slot }
+    {}
+
+    void unlock()
+    {
+      if (--depth == 0) {
+        slot->epoch.store(0, std::memory_order_release);
+      }
+    }
+
+    RealtimeRegistry const* registry;
+    ReaderSlot* slot;
+    int depth{ 0 };
+  };
+
+  /**
+   * Constructor.
+   * @param capacity the number of distinct ids that can be inserted
+   * @param maxNumReaders the number of readers that can be registered at the same time
+   */
+  RealtimeRegistry(int capacity, int maxNumReaders)
+    : readerSlots(static_cast<size_t>(maxNumReaders))
+  {
+    // at most half full, to keep the probe sequences short
+    size_t size = 1;
+    while (size < 2 * static_cast<size_t>(capacity)) {
+      size *= 2;
+    }
+    entries = std::vector<Entry>(size);
+    mask = size - 1;
+    maxNumIds = capacity;
+  }
+
+  /**
+   * Registers a reader. Lock-free, it does not allocate.
+   * @return the reader, or nothing if maxNumReaders readers are already registered
+   */
+  std::optional<Reader> registerReader()
+  {
+    for (auto& slot : readerSlots) {
+      bool expected = false;
+      if (slot.isTaken.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+        return Reader{ this, &slot };
+      }
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * Inserts an object, or replaces the one with the same id, which is destroyed once no reader can hold it. It locks
+   * a mutex: it must not be called from a realtime thread.
+   * @param id the id of the object
+   * @param value the object
+   * @return true if the object was set, false if there is no room for a new id
+   */
+  bool set(uint64_t id, std::unique_ptr<Value const> value)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    auto entry = findEntry(id);
+    if (!entry) {
+      if (numIds == maxNumIds) {
+        return false;
+      }
+      entry = &entries[hash(id) & mask];
+      while (entry->isUsed.load(std::memory_order_relaxed)) {
+        entry = &entries[(static_cast<size_t>(entry - entries.data()) + 1) & mask];
+      }
+      entry->id.store(id, std::memory_order_relaxed);
+      entry->isUsed.store(true, std::memory_order_release);
+      ++numIds;
+    }
+    retire(entry->value.exchange(value.release(), std::memory_order_seq_cst));
+    collectLocked();
+    return true;
+  }
+
+  /**
+   * Removes an object, which is destroyed once no reader can hold it. It locks a mutex: it must not be called from a
+   * realtime thread.
+   * @param id the id of the object
+   * @return true if there was an object with the id, false otherwise
+   */
+  bool remove(uint64_t id)
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    auto const entry = findEntry(id);
+    if (!entry || !entry->value.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    retire(entry->value.exchange(nullptr, std::memory_order_seq_cst));
+    collectLocked();
+    return true;
+  }
+
+  /**
+   * Destroys the replaced and removed objects that no reader can hold anymore. It is also called by set and remove.
+   * It locks a mutex: it must not be called from a realtime thread.
+   * @return the number of objects still waiting to be destroyed
+   */
+  int collect()
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    return collectLocked();
+  }
+
+  /**
+   * Destructor. No reader must be reading.
+   */
+  ~RealtimeRegistry()
+  {
+    for (auto& entry : entries) {
+      delete entry.value.load(std::memory_order_relaxed);
+    }
+  }
+
+  RealtimeRegistry(RealtimeRegistry const&) = delete;
+  RealtimeRegistry& operator=(RealtimeRegistry const&) = delete;
+
+private:
+  struct RetiredValue
+  {
+    std::unique_ptr<Value const> value;
+    uint64_t epoch;
+  };
+
+  static size_t hash(uint64_t id)
+  {
+    // splitmix64 finalizer, so that sequential ids spread over the table
+    id = (id ^ (id >> 30)) * 0xbf58476d1ce4e5b9ull;
+    id = (id ^ (id >> 27)) * 0x94d049bb133111ebull;
+    return static_cast<size_t>(id ^ (id >> 31));
+  }
+
+  Entry* findEntry(uint64_t id) const
+  {
+    auto index = hash(id) & mask;
+    for (size_t i = 0; i <= mask; ++i) {
+      auto& entry = entries[index];
+      if (!entry.isUsed.load(std::memory_order_acquire)) {
+        return nullptr;
+      }
+      if (entry.id.load(std::memory_order_relaxed) == id) {
+        return const_cast<Entry*>(&entry);
+      }
+      index = (index + 1) & mask;
+    }
+    return nullptr;
+  }
+
+  Value const* find(uint64_t id) const
+  {
+    auto const entry = findEntry(id);
+    return entry ? entry->value.load(std::memory_order_seq_cst) : nullptr;
+  }
+
+  void retire(Value const* value)
+  {
+    if (value) {
+      // the readers that announced an epoch up to this one may hold the value
+      retiredValues.push_back({ std::unique_ptr<Value const>(value), epoch.fetch_add(1, std::memory_order_seq_cst) });
+    }
+  }
+
+  int collectLocked()
+  {
+    if (retiredValues.empty()) {
+      return 0;
+    }
+    auto minEpoch = UINT64_MAX;
+    for (auto& slot : readerSlots) {
+      auto const readerEpoch = slot.epoch.load(std::memory_order_seq_cst);
+      if (readerEpoch != 0 && readerEpoch < minEpoch) {
+        minEpoch = readerEpoch;
+      }
+    }
+    retiredValues.erase(std::remove_if(retiredValues.begin(),
+                                       retiredValues.end(),
+                                       [&](RetiredValue const& retired) { return retired.epoch < minEpoch; }),
+                        retiredValues.end());
+    return static_cast<int>(retiredValues.size());
+  }
+
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> epoch{ 1 };
+  std::vector<ReaderSlot> readerSlots;
+  std::vector<Entry> entries;
+  size_t mask{ 0 };
+  int maxNumIds{ 0 };
+  int numIds{ 0 };
+  std::vector<RetiredValue> retiredValues;
+  std::mutex mutex;
+};
+
+} // namespace lockfree
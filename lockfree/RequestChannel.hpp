@@ -0,0 +1,269 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "AsyncObjectInterface.hpp"
+#include "Messenger.hpp"
+#include "NodePool.hpp"
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <utility>
+
+namespace lockfree {
+
+/**
+ * A channel through which real-time threads submit requests to a worker, such as loading a file or planning an FFT,
+ * and get the replies back. Each request travels in a slot from a preallocated NodePool, which also holds its reply,
+ * so submitting a request and polling for its reply are lock-free and do not allocate, and several threads can submit
+ * concurrently without taking the free slots from each other.
+ * The worker handles all the pending requests in one batch, either by calling serve from its own thread, or by
+ * attaching the channel to an AsyncThread, which calls the handler given on creation.
+ * Requests and replies are only constructed and destroyed by the worker, so they can own resources.
+ * @tparam Request the type of the requests, which must be default constructible and move assignable
+ * @tparam Reply the type of the replies, which must be default constructible and move assignable
+ */
+template<class Request, class Reply>
+class RequestChannel final : public detail::AsyncObjectInterface
+{
+  enum SlotState
+  {
+    pending,
+    replied,
+    abandoned
+  };
+
+  struct Slot
+  {
+    Request request;
+    Reply reply;
+    std::atomic<int> state{ pending };
+
+    Slot() = default;
+
+    // only used to preallocate the slots
+    Slot(Slot&& other) noexcept
+      : request{ std::move(other.request) }
+      , reply{ std::move(other.reply) }
+      , state{ other.state.load(std::memory_order_relaxed) }
+    {}
+  };
+
+public:
+  using Handler = std::function<void(Request& request, Reply& reply)>;
+
+  /**
+   * A handle to a submitted request, which the submitting thread polls for the reply. Releasing the handle, or
+   * destroying it, returns the slot to the pool, also if the reply has not arrived yet. Lock-free.
+   * The handle shares the ownership of the channel, so it can outlive any other reference to it, but then releasing
+   * the handle destroys the channel, which is not real-time safe.
+   */
+  class Handle final
+  {
+  public:
+    Handle() = default;
+
+    Handle(Handle&& other) noexcept
+      : node{ std::exchange(other.node, nullptr) }
+      , channel{ std::move(other.channel) }
+    {}
+
+    Handle& operator=(Handle&& other) noexcept
+    {
+      if (this != &other) {
+        release();
+        node = std::exchange(other.node, nullptr);
+        channel = std::move(other.channel);
+      }
+      return *this;
+    }
+
+    /**
+     * @return true if the handle refers to a request, false if the request could not be submitted or the handle has
+     * been released
+     */
+    bool isValid() const
+    {
+      return node != nullptr;
+    }
+
+    /**
+     * @return true if the reply has arrived, false otherwise
+     */
+    bool isReady() const
+    {
+      return node && node->get().state.load(std::memory_order_acquire) == replied;
+    }
+
+    /**
+     * @return the reply. It must be called only after isReady returned true. The reply can be moved from, but
+     * anything left in it is destroyed by the worker when the slot is reused.
+     */
+    Reply& getReply()
+    {
+      assert(isReady());
+      return node->get().reply;
+    }
+
+    /**
+     * Returns the slot to the pool. If the reply has not arrived yet, the worker returns it after replying.
+     */
+    void release()
+    {
+      if (!node) {
+        return;
+      }
+      int expected = pending;
+      if (!node->get().state.compare_exchange_strong(expected, abandoned, std::memory_order_acq_rel)) {
+        channel->slots.recycle(node);
+      }
+      node = nullptr;
+      channel.reset();
+    }
+
+    ~Handle()
+    {
+      release();
+    }
+
+    Handle(Handle const&) = delete;
+    Handle& operator=(Handle const&) = delete;
+
+  private:
+    friend class RequestChannel;
+
+    Handle(MessageNode<Slot>* node, std::shared_ptr<RequestChannel> channel)
+      : node{ node }
+      , channel{ std::move(channel) }
+    {}
+
+    MessageNode<Slot>* node{ nullptr };
+    std::shared_ptr<RequestChannel> channel;
+  };
+
+  /**
+   * Creates a RequestChannel.
+   * @param numSlots the number of requests that can be in flight at the same time
+   * @param handler the handler the AsyncThread calls on the pending requests, if the channel is attached to one
+   * @return the channel
+   */
+  static std::shared_ptr<RequestChannel> create(int numSlots, Handler handler = nullptr)
+  {
+    auto channel = std::shared_ptr<RequestChannel>(new RequestChannel(std::move(handler)));
+    channel->allocateSlots(numSlots);
+    return channel;
+  }
+
+  /**
+   * Submits a request, if a slot is available. Lock-free, it does not allocate.
+   * @param request the request
+   * @return the handle to poll for the reply, which is not valid if there was no slot available, in which case the
+   * request is not moved from
+   */
+  Handle submit(Request&& request)
+  {
+    auto node = slots.pop();
+    if (!node) {
+      return {};
+    }
+    auto& slot = node->get();
+    slot.request = std::move(request);
+    slot.state.store(pending, std::memory_order_relaxed);
+    messenger.send(node);
+    return Handle(node, std::static_pointer_cast<RequestChannel>(this->shared_from_this()));
+  }
+
+  /**
+   * Handles all the pending requests in one batch, in the order they were submitted. It must not be called from a
+   * real-time thread.
+   * @param handler a functor with signature void(Request& request, Reply& reply), which writes the reply
+   * @return the number of requests handled
+   */
+  template<class RequestHandler>
+  int serve(RequestHandler&& handler)
+  {
+    auto node = messenger.receiveAllNodes();
+    // reversed to the order of submission
+    MessageNode<Slot>* head = nullptr;
+    while (node) {
+      auto const next = node->next();
+      node->next() = head;
+      head = node;
+      node = next;
+    }
+    int numRequests = 0;
+    while (head) {
+      // read before replying, as then the submitting thread can recycle the node
+      auto const next = head->next();
+      head->next() = nullptr;
+      auto& slot = head->get();
+      handler(slot.request, slot.reply);
+      slot.request = Request{};
+      if (slot.state.exchange(replied, std::memory_order_acq_rel) == abandoned) {
+        slot.reply = Reply{};
+        slots.recycle(head);
+      }
+      ++numRequests;
+      head = next;
+    }
+    return numRequests;
+  }
+
+  /**
+   * Preallocates more slots.
+   * @param numSlots the number of slots to allocate
+   */
+  void allocateSlots(int numSlots)
+  {
+    slots.allocateNodes(numSlots);
+  }
+
+  /**
+   * Destructor.
+   */
+  ~RequestChannel() override
+  {
+    // the pending requests are in slots of the pool, which the Messenger must not free
+    slots.recycle(messenger.receiveAllNodes());
+  }
+
+private:
+  explicit RequestChannel(Handler handler)
+    : handler{ std::move(handler) }
+  {
+    messenger.setListener(this->getChangeListener());
+  }
+
+  bool timerCallback() override
+  {
+    if (!handler) {
+      return false;
+    }
+    return serve(handler) > 0;
+  }
+
+  NodePool<Slot> slots;
+  Messenger<Slot> messenger;
+  Handler handler;
+};
+
+} // namespace lockfree
@@ -0,0 +1,137 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace lockfree {
+
+/**
+ * Publishes immutable snapshots of an object from one writer thread to any number of reader threads, RCU-style: the
+ * writer swaps an atomic pointer to the current snapshot, and keeps the replaced ones until no reader can be accessing
+ * them. Readers are lock-free, the writer never waits for them: reclamation is just deferred to a later call.
+ * The readers are counted by epoch, and the writer starts a new epoch when it frees the snapshots replaced in the
+ * previous one: the readers of the old epoch finish soon after, as new readers are counted in the new one, so the
+ * replaced snapshots are freed even if the reads always overlap.
+ * @tparam T the type of the snapshots
+ */
+template<class T>
+class SnapshotPublisher final
+{
+public:
+  /**
+   * Constructor.
+   * @param snapshot the initial snapshot
+   */
+  explicit SnapshotPublisher(std::shared_ptr<T const> snapshot)
+    : current{ new Holder{ std::move(snapshot) } }
+  {}
+
+  /**
+   * Gets the last published snapshot. Lock-free, it can be called from any thread.
+   * @return the last published snapshot
+   */
+  std::shared_ptr<T const> get() const
+  {
+    while (true) {
+      auto const readerEpoch = epoch.load(std::memory_order_seq_cst);
+      auto& readers = numReaders[readerEpoch % 2];
+      readers.fetch_add(1, std::memory_order_seq_cst);
+      // a reader counted in an epoch that has already ended could access the snapshots the writer is freeing
+      if (epoch.load(std::memory_order_seq_cst) == readerEpoch) {
+        auto snapshot = current.load(std::memory_order_seq_cst)->snapshot;
+        readers.fetch_sub(1, std::memory_order_release);
+        return snapshot;
+      }
+      readers.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  /**
+   * Publishes a new snapshot. It must be called only from the writer thread.
+   * @param snapshot the snapshot to publish
+   */
+  void publish(std::shared_ptr<T const> snapshot)
+  {
+    auto const prevHolder = current.exchange(new Holder{ std::move(snapshot) }, std::memory_order_seq_cst);
+    retired.push_back(prevHolder);
+    reclaim();
+  }
+
+  /**
+   * Frees the replaced snapshots if no reader can be accessing them. It must be called only from the writer thread.
+   * @return the number of replaced snapshots that are still waiting to be freed
+   */
+  int reclaim()
+  {
+    if (draining.empty() && !retired.empty()) {
+      // any reader that is counted in the new epoch will see the current snapshot
+      draining.swap(retired);
+      epoch.store(epoch.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+    }
+    auto const prevEpoch = epoch.load(std::memory_order_relaxed) - 1;
+    if (!draining.empty() && numReaders[prevEpoch % 2].load(std::memory_order_seq_cst) == 0) {
+      freeHolders(draining);
+    }
+    return static_cast<int>(draining.size() + retired.size());
+  }
+
+  /**
+   * Destructor.
+   */
+  ~SnapshotPublisher()
+  {
+    freeHolders(draining);
+    freeHolders(retired);
+    delete current.load(std::memory_order_relaxed);
+  }
+
+  SnapshotPublisher(SnapshotPublisher const&) = delete;
+  SnapshotPublisher& operator=(SnapshotPublisher const&) = delete;
+
+private:
+  struct Holder
+  {
+    std::shared_ptr<T const> snapshot;
+  };
+
+  static void freeHolders(std::vector<Holder*>& holders)
+  {
+    for (auto holder : holders) {
+      delete holder;
+    }
+    holders.clear();
+  }
+
+  std::atomic<Holder*> current;
+  // the epoch is only changed by the writer, and the readers are counted by its parity
+  std::atomic<uint64_t> epoch{ 0 };
+  mutable std::atomic<int> numReaders[2]{};
+  // replaced in the current epoch
+  std::vector<Holder*> retired;
+  // replaced in the previous epoch, freed once its readers are done
+  std::vector<Holder*> draining;
+};
+
+} // namespace lockfree
@@ -0,0 +1,378 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "Messenger.hpp"
+#include "NodePool.hpp"
+#include "QueueWorld/QwConfig.h"
+#include "inplace_function.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lockfree {
+
+/**
+ * A fixed capacity Chase-Lev work-stealing deque of pointers. The owner thread pushes and pops at the bottom, and any
+ * other thread steals from the top. All operations are lock-free.
+ * @tparam T the type of the elements pointed to
+ */
+template<class T>
+class WorkStealingDeque final
+{
+public:
+  /**
+   * Constructor.
+   * @param capacity the capacity of the deque, rounded up to a power of two
+   */
+  explicit WorkStealingDeque(int capacity)
+  {
+    int64_t size = 1;
+    while (size < capacity) {
+      size *= 2;
+    }
+    mask = size - 1;
+    buffer.reset(new std::atomic<T*>[static_cast<size_t>(size)]);
+    for (int64_t i = 0; i < size; ++i) {
+      buffer[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Pushes an element at the bottom. Only the owner thread can call it.
+   * @param element the element to push
+   * @return true if the element was pushed, false if the deque is full
+   */
+  bool push(T* element)
+  {
+    auto const b = bottom.load(std::memory_order_relaxed);
+    auto const t = top.load(std::memory_order_acquire);
+    if (b - t > mask) {
+      return false;
+    }
+    buffer[b & mask].store(element, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Pops an element from the bottom. Only the owner thread can call it.
+   * @return the element, or nullptr if the deque is empty
+   */
+  T* pop()
+  {
+    auto const b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_seq_cst);
+    auto t = top.load(std::memory_order_seq_cst);
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    auto element = buffer[b & mask].load(std::memory_order_relaxed);
+    if (t == b) {
+      // the last element, which a thief may be stealing
+      if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        element = nullptr;
+      }
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return element;
+  }
+
+  /**
+   * Steals an element from the top. Any thread can call it.
+   * @return the element, or nullptr if the deque is empty or another thread took the element first
+   */
+  T* steal()
+  {
+    auto t = top.load(std::memory_order_seq_cst);
+    auto const b = bottom.load(std::memory_order_seq_cst);
+    if (t >= b) {
+      return nullptr;
+    }
+    auto const element = buffer[t & mask].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return element;
+  }
+
+private:
+  alignas(CACHE_LINE_SIZE) std::atomic<int64_t> top{ 0 };
+  alignas(CACHE_LINE_SIZE) std::atomic<int64_t> bottom{ 0 };
+  std::unique_ptr<std::atomic<T*>[]> buffer;
+  int64_t mask{ 0 };
+};
+
+/**
+ * A pool of worker threads that run tasks submitted from any thread, including real-time ones.
+ * The tasks are submitted through a global injection queue, a Messenger whose nodes are taken from a NodePool, so
+ * submitting a task with submitIfNodeAvailable is lock-free and does not allocate, and the threads that submit tasks
+ * concurrently do not take the free nodes from each other. A worker takes all the tasks in the injection queue at
+ * once, puts them in its own Chase-Lev deque, and the workers that run out of tasks steal from the deques of the
+ * others. Idle workers sleep for at most maxIdleWait, as a real-time thread cannot wake them up.
+ * A task can report its completion through a CompletionQueue, which the submitting thread polls. The tasks that have
+ * not been started when the pool is destroyed are discarded.
+ * @tparam TaskClosureCapacity the capacity of the closures of the tasks
+ */
+template<size_t TaskClosureCapacity = 64>
+class TaskPool final
+{
+public:
+  using Task = stdext::inplace_function<void(), TaskClosureCapacity>;
+
+  /**
+   * A queue through which the pool reports the completion of the tasks, by the tag given on submission. The tags are
+   * received by a single thread, lock-free.
+   */
+  class CompletionQueue final
+  {
+  public:
+    /**
+     * Constructor.
+     * @param numNodesToPreallocate the number of completions that can be pending without the pool allocating
+     */
+    explicit CompletionQueue(int numNodesToPreallocate)
+    {
+      messenger.allocateNodes(numNodesToPreallocate);
+    }
+
+    /**
+     * Receives the tags of the tasks completed since the last call, in the order they completed. Lock-free.
+     * @param handler a functor with signature void(uint64_t tag)
+     * @return the number of completions received
+     */
+    template<class Handler>
+    int receive(Handler handler)
+    {
+      return receiveAndHandleMessageStack(messenger, [&](uint64_t& tag) { handler(tag); });
+    }
+
+  private:
+    friend class TaskPool;
+
+    Messenger<uint64_t, Producers::multiple, Consumers::single> messenger;
+  };
+
+  /**
+   * Constructor. It starts the workers.
+   * @param numWorkers the number of worker threads
+   * @param numNodesToPreallocate the number of tasks that can be submitted with submitIfNodeAvailable before any is
+   * run
+   * @param dequeCapacity the capacity of the deque of each worker
+   * @param maxIdleWait the maximum time an idle worker sleeps before looking for tasks again
+   */
+  TaskPool(int numWorkers,
+           int numNodesToPreallocate,
+           int dequeCapacity = 1024,
+           std::chrono::microseconds maxIdleWait = std::chrono::microseconds(1000))
+    : maxIdleWait{ maxIdleWait }
+  {
+    jobs.allocateNodes(numNodesToPreallocate);
+    workers.reserve(numWorkers);
+    for (int i = 0; i < numWorkers; ++i) {
+      workers.push_back(std::make_unique<Worker>(dequeCapacity));
+    }
+    for (int i = 0; i < numWorkers; ++i) {
+      workers[i]->thread = std::thread([this, i] { runWorker(i); });
+    }
+  }
+
+  /**
+   * Submits a task if a preallocated node is available. Lock-free, it does not allocate: it can be called from a
+   * real-time thread. It does not wake up the workers.
+   * @param task the task, which is not moved from if there is no node available
+   * @param completionQueue the queue through which to report the completion of the task, or nullptr
+   * @param tag the tag to report the completion with
+   * @return true if the task was submitted, false otherwise
+   */
+  bool submitIfNodeAvailable(Task&& task, CompletionQueue* completionQueue = nullptr, uint64_t tag = 0)
+  {
+    auto node = jobs.pop();
+    if (!node) {
+      return false;
+    }
+    node->get() = Job{ std::move(task), completionQueue, tag };
+    injectionQueue.send(node);
+    return true;
+  }
+
+  /**
+   * Submits a task, and wakes up the workers. It is not lock-free, as it allocates a node if there is none available.
+   * @param task the task
+   * @param completionQueue the queue through which to report the completion of the task, or nullptr
+   * @param tag the tag to report the completion with
+   */
+  void submit(Task task, CompletionQueue* completionQueue = nullptr, uint64_t tag = 0)
+  {
+    auto node = jobs.popOrAllocate();
+    node->get() = Job{ std::move(task), completionQueue, tag };
+    injectionQueue.send(node);
+    wakeUp();
+  }
+
+  /**
+   * Wakes up the idle workers. It is not lock-free.
+   */
+  void wakeUp()
+  {
+    {
+      auto const lock = std::lock_guard<std::mutex>(mutex);
+      ++wakeUpCounter;
+    }
+    wakeUpCondition.notify_all();
+  }
+
+  /**
+   * @return the number of worker threads
+   */
+  int getNumWorkers() const
+  {
+    return static_cast<int>(workers.size());
+  }
+
+  /**
+   * Destructor. It stops and joins the workers.
+   */
+  ~TaskPool()
+  {
+    stopFlag.store(true, std::memory_order_release);
+    wakeUp();
+    for (auto& worker : workers) {
+      worker->thread.join();
+    }
+    // the tasks left in the deques and in the injection queue go back to the pool, which frees them
+    for (auto& worker : workers) {
+      while (auto node = worker->deque.pop()) {
+        node->next() = nullptr;
+        jobs.recycle(node);
+      }
+    }
+    jobs.recycle(injectionQueue.receiveAllNodes());
+  }
+
+  TaskPool(TaskPool const&) = delete;
+  TaskPool& operator=(TaskPool const&) = delete;
+
+private:
+  struct Job
+  {
+    Task task;
+    CompletionQueue* completionQueue{ nullptr };
+    uint64_t tag{ 0 };
+  };
+
+  using JobNode = MessageNode<Job>;
+
+  struct Worker
+  {
+    explicit Worker(int dequeCapacity)
+      : deque{ dequeCapacity }
+    {}
+
+    WorkStealingDeque<JobNode> deque;
+    std::thread thread;
+  };
+
+  JobNode* takeFromInjectionQueue(Worker& worker)
+  {
+    // the head is the last task submitted
+    auto node = injectionQueue.receiveAllNodes();
+    if (!node) {
+      return nullptr;
+    }
+    JobNode* oldest = nullptr;
+    while (node) {
+      auto const next = node->next();
+      node->next() = nullptr;
+      if (!next) {
+        oldest = node;
+      }
+      else if (!worker.deque.push(node)) {
+        // the deque is full: the rest goes back to the injection queue
+        node->next() = next;
+        injectionQueue.sendMultiple(node);
+        break;
+      }
+      node = next;
+    }
+    return oldest;
+  }
+
+  JobNode* steal(int workerIndex)
+  {
+    int const numWorkers = getNumWorkers();
+    for (int i = 1; i < numWorkers; ++i) {
+      if (auto node = workers[(workerIndex + i) % numWorkers]->deque.steal()) {
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  void run(JobNode* node)
+  {
+    auto& job = node->get();
+    job.task();
+    job.task = nullptr;
+    if (job.completionQueue) {
+      job.completionQueue->messenger.send(uint64_t{ job.tag });
+    }
+    jobs.recycle(node);
+  }
+
+  void runWorker(int workerIndex)
+  {
+    auto& worker = *workers[workerIndex];
+    while (!stopFlag.load(std::memory_order_acquire)) {
+      auto node = worker.deque.pop();
+      if (!node) {
+        node = takeFromInjectionQueue(worker);
+      }
+      if (!node) {
+        node = steal(workerIndex);
+      }
+      if (node) {
+        run(node);
+        continue;
+      }
+      auto lock = std::unique_lock<std::mutex>(mutex);
+      auto const counter = wakeUpCounter;
+      wakeUpCondition.wait_for(lock, maxIdleWait, [&] { return wakeUpCounter != counter; });
+    }
+  }
+
+  NodePool<Job> jobs;
+  Messenger<Job> injectionQueue;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::chrono::microseconds const maxIdleWait;
+  std::atomic<bool> stopFlag{ false };
+  uint64_t wakeUpCounter{ 0 };
+  std::condition_variable wakeUpCondition;
+  std::mutex mutex;
+};
+
+} // namespace lockfree
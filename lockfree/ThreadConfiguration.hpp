@@ -0,0 +1,197 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include <cerrno>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define LOCKFREE_THREAD_CONFIGURATION_LINUX 1
+#elif defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sys/mman.h>
+#define LOCKFREE_THREAD_CONFIGURATION_POSIX 1
+#endif
+
+namespace lockfree {
+
+/**
+ * The errors that occurred applying a ThreadConfiguration. Each one is 0 if that part of the configuration was applied
+ * or not requested, otherwise it is the errno value of the failure, ENOTSUP if the platform does not support it.
+ */
+struct ThreadConfigurationResult final
+{
+  int affinityError{ 0 };
+  int schedulingError{ 0 };
+  int niceLevelError{ 0 };
+  int memoryLockError{ 0 };
+  int nameError{ 0 };
+
+  /**
+   * @return true if the whole configuration was applied, false otherwise
+   */
+  bool isSuccessful() const
+  {
+    return !affinityError && !schedulingError && !niceLevelError && !memoryLockError && !nameError;
+  }
+};
+
+/**
+ * The configuration of a non realtime thread, such as the one of an AsyncThread, so that it does not compete with the
+ * realtime threads for their cores, and is recognizable in top and perf.
+ */
+struct ThreadConfiguration final
+{
+  enum class SchedulingPolicy
+  {
+    // keep the policy the thread was created with
+    inherit,
+    // SCHED_OTHER
+    other,
+    // SCHED_BATCH, Linux only
+    batch,
+    // SCHED_IDLE, Linux only
+    idle
+  };
+
+  // the cores the thread can run on, empty to keep the affinity it was created with. Not supported on Apple
+  std::vector<int> cpus;
+  SchedulingPolicy schedulingPolicy{ SchedulingPolicy::inherit };
+  // whether to set the nice level, which is per thread only on Linux, and ignored with SchedulingPolicy::idle
+  bool setNiceLevel{ false };
+  int niceLevel{ 0 };
+  // whether to lock all the current and future memory pages of the process, with mlockall
+  bool lockMemory{ false };
+  // the name of the thread, empty to keep the current one. Truncated to 15 characters on Linux
+  std::string name;
+
+  /**
+   * Applies the configuration to the calling thread.
+   * @return the errors that occurred
+   */
+  ThreadConfigurationResult applyToCurrentThread() const
+  {
+    ThreadConfigurationResult result;
+    if (!cpus.empty()) {
+      result.affinityError = applyAffinity();
+    }
+    if (schedulingPolicy != SchedulingPolicy::inherit) {
+      result.schedulingError = applySchedulingPolicy();
+    }
+    if (setNiceLevel && schedulingPolicy != SchedulingPolicy::idle) {
+      result.niceLevelError = applyNiceLevel();
+    }
+    if (lockMemory) {
+      result.memoryLockError = applyMemoryLock();
+    }
+    if (!name.empty()) {
+      result.nameError = applyName();
+    }
+    return result;
+  }
+
+private:
+  int applyAffinity() const
+  {
+#if defined(LOCKFREE_THREAD_CONFIGURATION_LINUX)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (int cpu : cpus) {
+      if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return EINVAL;
+      }
+      CPU_SET(cpu, &cpuSet);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#else
+    return ENOTSUP;
+#endif
+  }
+
+  int applySchedulingPolicy() const
+  {
+#if defined(LOCKFREE_THREAD_CONFIGURATION_LINUX) || defined(LOCKFREE_THREAD_CONFIGURATION_POSIX)
+    int policy = SCHED_OTHER;
+    switch (schedulingPolicy) {
+      case SchedulingPolicy::batch:
+#if defined(LOCKFREE_THREAD_CONFIGURATION_LINUX)
+        policy = SCHED_BATCH;
+        break;
+#else
+        return ENOTSUP;
+#endif
+      case SchedulingPolicy::idle:
+#if defined(LOCKFREE_THREAD_CONFIGURATION_LINUX)
+        policy = SCHED_IDLE;
+        break;
+#else
+        return ENOTSUP;
+#endif
+      default:
+        break;
+    }
+    sched_param param{};
+    param.sched_priority = 0;
+    return pthread_setschedparam(pthread_self(), policy, &param);
+#else
+    return ENOTSUP;
+#endif
+  }
+
+  int applyNiceLevel() const
+  {
+#if defined(LOCKFREE_THREAD_CONFIGURATION_LINUX)
+    auto const threadId = static_cast<id_t>(syscall(SYS_gettid));
+    return setpriority(PRIO_PROCESS, threadId, niceLevel) == 0 ? 0 : errno;
+#else
+    return ENOTSUP;
+#endif
+  }
+
+  int applyMemoryLock() const
+  {
+#if defined(LOCKFREE_THREAD_CONFIGURATION_LINUX) || defined(LOCKFREE_THREAD_CONFIGURATION_POSIX)
+    return mlockall(MCL_CURRENT | MCL_FUTURE) == 0 ? 0 : errno;
+#else
+    return ENOTSUP;
+#endif
+  }
+
+  int applyName() const
+  {
+#if defined(LOCKFREE_THREAD_CONFIGURATION_LINUX)
+    return pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#elif defined(__APPLE__)
+    return pthread_setname_np(name.c_str());
+#else
+    return ENOTSUP;
+#endif
+  }
+};
+
+} // namespace lockfree
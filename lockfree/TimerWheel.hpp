@@ -0,0 +1,289 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include <cstdint>
+#include <limits>
+
+namespace lockfree {
+
+class TimerWheel;
+
+/**
+ * A node that can be scheduled in a TimerWheel. Classes that need to be scheduled derive from it.
+ */
+class TimerWheelNode
+{
+  friend class TimerWheel;
+
+public:
+  /**
+   * @return true if the node is scheduled in a TimerWheel
+   */
+  bool isScheduled() const
+  {
+    return level >= 0;
+  }
+
+  /**
+   * @return the tick at which the node is scheduled to expire, valid only if the node is scheduled
+   */
+  uint64_t getDeadline() const
+  {
+    return deadline;
+  }
+
+private:
+  TimerWheelNode* prev{ nullptr };
+  TimerWheelNode* next{ nullptr };
+  uint64_t deadline{ 0 };
+  int level{ -1 };
+  int slot{ 0 };
+};
+
+/**
+ * A hierarchical timing wheel. Nodes are scheduled to expire at a tick, and are put in a slot of the lowest level that
+ * can hold their deadline. Each level has 64 slots, each one spanning 64 times the ticks of a slot of the level below.
+ * When the wheel advances to the beginning of a slot of a higher level, its nodes are moved to the lower levels.
+ * Scheduling and canceling a node is O(1), and so is expiring it, apart from being cascaded at most once per level.
+ * Advancing the wheel jumps over the ticks at which nothing happens. Not thread-safe.
+ */
+class TimerWheel final
+{
+  static constexpr int bitsPerLevel = 6;
+  static constexpr int numSlots = 1 << bitsPerLevel;
+  static constexpr int numLevels = 4;
+
+public:
+  /**
+   * Constructor.
+   * @param currentTick the tick the wheel starts from
+   */
+  explicit TimerWheel(uint64_t currentTick = 0)
+    : currentTick{ currentTick }
+  {}
+
+  /**
+   * Schedules a node, or reschedules it if it was already scheduled. O(1).
+   * @param node the node to schedule
+   * @param deadline the tick at which the node expires. Deadlines that are not in the future expire at the next tick.
+   */
+  void schedule(TimerWheelNode& node, uint64_t deadline)
+  {
+    if (node.isScheduled()) {
+      cancel(node);
+    }
+    node.deadline = deadline > currentTick ? deadline : currentTick + 1;
+    insert(node);
+    ++numNodes;
+  }
+
+  /**
+   * Removes a node from the wheel, if it is scheduled. O(1).
+   * @param node the node to cancel
+   */
+  void cancel(TimerWheelNode& node)
+  {
+    if (!node.isScheduled()) {
+      return;
+    }
+    unlink(node);
+    --numNodes;
+  }
+
+  /**
+   * Advances the wheel to a tick, calling a functor on each node that expires, in order of deadline. The functor can
+   * schedule again the node it is called on, but it must not schedule or cancel any other node.
+   * @param tick the tick to advance to
+   * @param onExpired the functor, with signature void(TimerWheelNode&)
+   */
+  template<class OnExpired>
+  void advance(uint64_t tick, OnExpired&& onExpired)
+  {
+    while (currentTick < tick) {
+      auto const ticksToNextEvent = getTicksUntilNextEvent();
+      if (ticksToNextEvent > tick - currentTick) {
+        currentTick = tick;
+        return;
+      }
+      currentTick += ticksToNextEvent;
+      cascade();
+      expire(onExpired);
+    }
+  }
+
+  /**
+   * @return the number of ticks after which the first node expires or is moved to a lower level, or the maximum value
+   * of uint64_t if the wheel is empty.
+   */
+  uint64_t getTicksUntilNextEvent() const
+  {
+    auto ticks = std::numeric_limits<uint64_t>::max();
+    for (int level = 0; level < numLevels; ++level) {
+      if (!occupiedSlots[level]) {
+        continue;
+      }
+      int const shift = level * bitsPerLevel;
+      auto const levelTick = currentTick >> shift;
+      for (int k = 1; k <= numSlots; ++k) {
+        if (occupiedSlots[level] & (uint64_t{ 1 } << ((levelTick + k) & (numSlots - 1)))) {
+          auto const eventTick = (levelTick + k) << shift;
+          if (eventTick - currentTick < ticks) {
+            ticks = eventTick - currentTick;
+          }
+          break;
+        }
+      }
+    }
+    return ticks;
+  }
+
+  /**
+   * @return the current tick
+   */
+  uint64_t getCurrentTick() const
+  {
+    return currentTick;
+  }
+
+  /**
+   * @return the number of scheduled nodes
+   */
+  int getNumScheduledNodes() const
+  {
+    return numNodes;
+  }
+
+  /**
+   * Destructor. It leaves all nodes unscheduled.
+   */
+  ~TimerWheel()
+  {
+    for (auto& level : slots) {
+      for (auto& head : level) {
+        while (head) {
+          unlink(*head);
+        }
+      }
+    }
+  }
+
+  TimerWheel(TimerWheel const&) = delete;
+  TimerWheel& operator=(TimerWheel const&) = delete;
+
+private:
+  void insert(TimerWheelNode& node)
+  {
+    auto const delta = node.deadline - currentTick;
+    int level = 0;
+    while (level < numLevels - 1 && delta >= (uint64_t{ 1 } << ((level + 1) * bitsPerLevel))) {
+      ++level;
+    }
+    auto deadline = node.deadline;
+    if (level == numLevels - 1) {
+      // deadlines beyond the span of the wheel wait in the top level, and are rescheduled when cascaded
+      auto const maxDelta = (uint64_t{ 1 } << (numLevels * bitsPerLevel)) - 1;
+      if (delta > maxDelta) {
+        deadline = currentTick + maxDelta;
+      }
+    }
+    int const slot = static_cast<int>((deadline >> (level * bitsPerLevel)) & (numSlots - 1));
+    link(node, level, slot);
+  }
+
+  void link(TimerWheelNode& node, int level, int slot)
+  {
+    auto& head = slots[level][slot];
+    node.level = level;
+    node.slot = slot;
+    node.prev = nullptr;
+    node.next = head;
+    if (head) {
+      head->prev = &node;
+    }
+    head = &node;
+    occupiedSlots[level] |= uint64_t{ 1 } << slot;
+  }
+
+  void unlink(TimerWheelNode& node)
+  {
+    auto& head = slots[node.level][node.slot];
+    if (node.prev) {
+      node.prev->next = node.next;
+    }
+    else {
+      head = node.next;
+    }
+    if (node.next) {
+      node.next->prev = node.prev;
+    }
+    if (!head) {
+      occupiedSlots[node.level] &= ~(uint64_t{ 1 } << node.slot);
+    }
+    node.prev = node.next = nullptr;
+    node.level = -1;
+  }
+
+  TimerWheelNode* takeSlot(int level, int slot)
+  {
+    auto head = slots[level][slot];
+    slots[level][slot] = nullptr;
+    occupiedSlots[level] &= ~(uint64_t{ 1 } << slot);
+    return head;
+  }
+
+  void cascade()
+  {
+    for (int level = numLevels - 1; level > 0; --level) {
+      int const shift = level * bitsPerLevel;
+      if (currentTick & ((uint64_t{ 1 } << shift) - 1)) {
+        continue;
+      }
+      auto node = takeSlot(level, static_cast<int>((currentTick >> shift) & (numSlots - 1)));
+      while (node) {
+        auto const next = node->next;
+        insert(*node);
+        node = next;
+      }
+    }
+  }
+
+  template<class OnExpired>
+  void expire(OnExpired& onExpired)
+  {
+    auto node = takeSlot(0, static_cast<int>(currentTick & (numSlots - 1)));
+    while (node) {
+      auto const next = node->next;
+      node->prev = node->next = nullptr;
+      node->level = -1;
+      --numNodes;
+      onExpired(*node);
+      node = next;
+    }
+  }
+
+  TimerWheelNode* slots[numLevels][numSlots]{};
+  uint64_t occupiedSlots[numLevels]{};
+  uint64_t currentTick;
+  int numNodes{ 0 };
+};
+
+} // namespace lockfree
@@ -0,0 +1,303 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+#include "RealtimeObject.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace lockfree {
+
+namespace detail {
+
+/**
+ * A versioned set of new objects for some RealtimeObjects, which the real-time thread swaps in all at once. After the
+ * swap, the bundle holds the objects that were replaced, which are freed on the non real-time thread.
+ */
+class TransactionBundle final
+{
+public:
+  struct Entry
+  {
+    void* realtimeObject;
+    void* object;
+    void (*swapOnRealtimeThread)(void* realtimeObject, void*& object);
+    void (*destroy)(void* object);
+  };
+
+  /**
+   * Makes the new object of an entry the last object of its RealtimeObject on the non real-time thread.
+   */
+  using Publisher = void (*)(void* realtimeObject, void* object);
+
+  TransactionBundle() = default;
+
+  TransactionBundle(std::vector<Entry> entries, uint64_t version)
+    : entries{ std::move(entries) }
+    , version{ version }
+  {}
+
+  TransactionBundle(TransactionBundle&& other) noexcept
+    : entries{ std::move(other.entries) }
+    , version{ other.version }
+  {
+    other.entries.clear();
+  }
+
+  TransactionBundle& operator=(TransactionBundle&& other) noexcept
+  {
+    if (this != &other) {
+      freeObjects();
+      entries = std::move(other.entries);
+      version = other.version;
+      other.entries.clear();
+    }
+    return *this;
+  }
+
+  void swapOnRealtimeThread()
+  {
+    for (auto& entry : entries) {
+      entry.swapOnRealtimeThread(entry.realtimeObject, entry.object);
+    }
+  }
+
+  uint64_t getVersion() const
+  {
+    return version;
+  }
+
+  ~TransactionBundle()
+  {
+    freeObjects();
+  }
+
+private:
+  void freeObjects()
+  {
+    for (auto& entry : entries) {
+      if (entry.object) {
+        entry.destroy(entry.object);
+      }
+    }
+  }
+
+  std::vector<Entry> entries;
+  uint64_t version{ 0 };
+};
+
+} // namespace detail
+
+/**
+ * A channel through which bundles of changes to several RealtimeObjects are published by Transactions. All the
+ * RealtimeObjects changed through a channel must be used by the same real-time thread, which receives all the changes
+ * of a bundle in one step, so that it never sees only some of the objects of a transaction switch over.
+ * The RealtimeObjects must outlive the channel.
+ */
+class TransactionChannel final
+{
+  friend class Transaction;
+
+public:
+  /**
+   * Swaps in all the objects of all the transactions committed since the last call, in the order they were
+   * committed, and sends the replaced objects back to the non real-time thread to be freed. Lock-free.
+   * @return the version of the last transaction received
+   */
+  uint64_t receiveChangesOnRealtimeThread()
+  {
+    auto head = messengerForNewBundles.receiveAllNodes();
+    if (head) {
+      handleMessageStack(head, [this](detail::TransactionBundle& bundle) {
+        bundle.swapOnRealtimeThread();
+        realtimeVersion = bundle.getVersion();
+      });
+      messengerForOldBundles.sendMultiple(head);
+    }
+    return realtimeVersion;
+  }
+
+  /**
+   * @return the version of the last transaction received on the real-time thread, 0 if none has been received
+   */
+  uint64_t getVersionOnRealtimeThread() const
+  {
+    return realtimeVersion;
+  }
+
+  /**
+   * @return the version of the last transaction committed, 0 if none has been committed
+   */
+  uint64_t getLastCommittedVersion()
+  {
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    return lastVersion;
+  }
+
+private:
+  uint64_t send(std::vector<detail::TransactionBundle::Entry> entries,
+               std::vector<detail::TransactionBundle::Publisher> const& publishers)
+  {
+    // publishing the objects and sending the bundle in one step keeps the last objects seen on the non real-time
+    // thread in the same order as the bundles, so that none of them can be freed while it is still the last one
+    auto const lock = std::lock_guard<std::mutex>(mutex);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      publishers[i](entries[i].realtimeObject, entries[i].object);
+    }
+    messengerForOldBundles.discardAndFreeAllMessages();
+    ++lastVersion;
+    messengerForNewBundles.send(detail::TransactionBundle(std::move(entries), lastVersion));
+    return lastVersion;
+  }
+
+  Messenger<detail::TransactionBundle, Producers::single, Consumers::single> messengerForNewBundles;
+  Messenger<detail::TransactionBundle, Producers::single, Consumers::single> messengerForOldBundles;
+  uint64_t realtimeVersion{ 0 };
+  uint64_t lastVersion{ 0 };
+  std::mutex mutex;
+};
+
+/**
+ * Stages new versions of several RealtimeObjects, and publishes them together through a TransactionChannel, so that
+ * the real-time thread picks up all of them in one step. Nothing is sent until commit is called, and a Transaction
+ * that is destroyed without being committed discards the staged objects.
+ * A RealtimeObject changed by a Transaction must not have pending changes sent with RealtimeObject::set, change or
+ * changeIf, and it must only be changed by Transactions afterwards.
+ */
+class Transaction final
+{
+public:
+  /**
+   * Constructor.
+   * @param channel the channel through which the transaction will be published
+   */
+  explicit Transaction(TransactionChannel& channel)
+    : channel{ channel }
+  {}
+
+  /**
+   * Stages a new version of an object.
+   * @param realtimeObject the RealtimeObject to change
+   * @param newObject the new version of the object
+   */
+  template<class Object>
+  void set(RealtimeObject<Object>& realtimeObject, std::unique_ptr<Object> newObject)
+  {
+    auto it = std::find_if(entries.begin(), entries.end(), [&](detail::TransactionBundle::Entry const& entry) {
+      return entry.realtimeObject == &realtimeObject;
+    });
+    if (it != entries.end()) {
+      it->destroy(it->object);
+      it->object = newObject.release();
+      return;
+    }
+    entries.push_back({ &realtimeObject,
+                        newObject.release(),
+                        [](void* realtimeObject_, void*& object) {
+                          auto& rtObject = *static_cast<RealtimeObject<Object>*>(realtimeObject_);
+                          auto& realtimeInstance = rtObject.realtimeInstance;
+                          auto const oldObject = realtimeInstance.release();
+                          realtimeInstance.reset(static_cast<Object*>(object));
+                          object = oldObject;
+                        },
+                        [](void* object) { delete static_cast<Object*>(object); } });
+    publishers.push_back([](void* realtimeObject_, void* object) {
+      auto& rtObject = *static_cast<RealtimeObject<Object>*>(realtimeObject_);
+      auto const lock = std::lock_guard<std::mutex>(rtObject.mutex);
+      // a pending object sent with RealtimeObject::set could be swapped in after this one
+      assert(rtObject.messengerForNewObjects.empty() && "a RealtimeObject cannot be changed both directly and by "
+                                                        "Transactions");
+      rtObject.isChangedByTransactions = true;
+      rtObject.lastObject = static_cast<Object*>(object);
+    });
+  }
+
+  /**
+   * Stages a change to an object. The change is applied to the version of the object already staged in the
+   * transaction, if any, otherwise to the last version of the object.
+   * @param realtimeObject the RealtimeObject to change
+   * @param changer a functor that creates the new version of the object, with signature
+   * std::unique_ptr<Object>(Object const&)
+   */
+  template<class Object, class Changer>
+  void change(RealtimeObject<Object>& realtimeObject, Changer const& changer)
+  {
+    auto it = std::find_if(entries.begin(), entries.end(), [&](detail::TransactionBundle::Entry const& entry) {
+      return entry.realtimeObject == &realtimeObject;
+    });
+    if (it != entries.end()) {
+      set(realtimeObject, changer(*static_cast<Object const*>(it->object)));
+      return;
+    }
+    auto const lock = std::lock_guard<std::mutex>(realtimeObject.mutex);
+    auto objectPtr = realtimeObject.getOnNonRealtimeThread();
+    if (!objectPtr)
+      return;
+    auto newObject = changer(*objectPtr);
+    set(realtimeObject, std::move(newObject));
+  }
+
+  /**
+   * Publishes all the staged objects as one bundle. After the commit the transaction is empty, and can be reused.
+   * @return the version of the committed bundle, or 0 if there was nothing to commit
+   */
+  uint64_t commit()
+  {
+    if (entries.empty()) {
+      return 0;
+    }
+    auto const version = channel.send(std::move(entries), publishers);
+    entries.clear();
+    publishers.clear();
+    return version;
+  }
+
+  /**
+   * @return the number of objects staged in the transaction
+   */
+  int getNumStagedObjects() const
+  {
+    return static_cast<int>(entries.size());
+  }
+
+  /**
+   * Destructor. Frees any staged object that was not committed.
+   */
+  ~Transaction()
+  {
+    for (auto& entry : entries) {
+      entry.destroy(entry.object);
+    }
+  }
+
+  Transaction(Transaction const&) = delete;
+  Transaction& operator=(Transaction const&) = delete;
+
+private:
+  TransactionChannel& channel;
+  std::vector<detail::TransactionBundle::Entry> entries;
+  std::vector<detail::TransactionBundle::Publisher> publishers;
+};
+
+} // namespace lockfree
@@ -0,0 +1,184 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "lockfree/AsyncObject.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+double nanosecondsPerOperation(Clock::duration duration, long long numOperations)
+{
+  return std::chrono::duration<double, std::nano>(duration).count() / static_cast<double>(numOperations);
+}
+
+char const* toString(lockfree::Producers producers)
+{
+  return producers == lockfree::Producers::single ? "SP" : "MP";
+}
+
+char const* toString(lockfree::Consumers consumers)
+{
+  return consumers == lockfree::Consumers::single ? "SC" : "MC";
+}
+
+/**
+ * Each producer pushes its own preallocated nodes one by one, while the consumers pop them all until every node has
+ * been received.
+ */
+template<lockfree::Producers producers, lockfree::Consumers consumers>
+void benchmarkLifoStack(int numProducers, int numConsumers, int numPushesPerProducer)
+{
+  using Node = lockfree::MessageNode<int>;
+  lockfree::LifoStack<int, producers, consumers> stack;
+  std::vector<std::vector<Node>> nodes(numProducers);
+  for (auto& producerNodes : nodes) {
+    producerNodes.reserve(numPushesPerProducer);
+    for (int i = 0; i < numPushesPerProducer; ++i) {
+      producerNodes.emplace_back(i);
+    }
+  }
+  long long const numPushes = static_cast<long long>(numProducers) * numPushesPerProducer;
+  std::atomic<long long> numReceived{ 0 };
+  std::atomic<bool> go{ false };
+  std::vector<std::thread> threads;
+  for (auto& producerNodes : nodes) {
+    threads.emplace_back([&] {
+      while (!go.load(std::memory_order_acquire)) {
+      }
+      for (auto& node : producerNodes) {
+        stack.push(&node);
+      }
+    });
+  }
+  for (int c = 0; c < numConsumers; ++c) {
+    threads.emplace_back([&] {
+      while (!go.load(std::memory_order_acquire)) {
+      }
+      while (numReceived.load(std::memory_order_relaxed) < numPushes) {
+        auto head = stack.pop_all();
+        if (head) {
+          numReceived.fetch_add(head->count(), std::memory_order_relaxed);
+        }
+      }
+    });
+  }
+  auto const begin = Clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto const end = Clock::now();
+  std::cout << "LifoStack " << toString(producers) << "/" << toString(consumers) << " with " << numProducers
+            << " producers and " << numConsumers << " consumers: " << nanosecondsPerOperation(end - begin, numPushes)
+            << " ns per push\n";
+}
+
+void benchmarkLifoStackPolicies()
+{
+  using lockfree::Consumers;
+  using lockfree::Producers;
+  int const numPushesPerProducer = 1 << 20;
+  std::cout << "===========================================================\n";
+  std::cout << "LIFO STACK POLICIES\n";
+  benchmarkLifoStack<Producers::single, Consumers::single>(1, 1, numPushesPerProducer);
+  benchmarkLifoStack<Producers::multiple, Consumers::single>(1, 1, numPushesPerProducer);
+  benchmarkLifoStack<Producers::single, Consumers::multiple>(1, 2, numPushesPerProducer);
+  benchmarkLifoStack<Producers::multiple, Consumers::multiple>(1, 2, numPushesPerProducer);
+  benchmarkLifoStack<Producers::multiple, Consumers::single>(2, 1, numPushesPerProducer);
+  benchmarkLifoStack<Producers::multiple, Consumers::multiple>(2, 2, numPushesPerProducer);
+  std::cout << "===========================================================\n\n";
+}
+
+/**
+ * One producer pushes nodes into a stack that is polled by many consumers, like an AsyncThread sending objects to the
+ * instances polled by real-time threads. The pollers find the stack empty almost every time.
+ */
+template<class Stack>
+void benchmarkIdlePolling(char const* name, int numPollers, int numPushes)
+{
+  using Node = lockfree::MessageNode<int>;
+  Stack stack;
+  std::vector<Node> nodes;
+  nodes.reserve(numPushes);
+  for (int i = 0; i < numPushes; ++i) {
+    nodes.emplace_back(i);
+  }
+  std::atomic<int> numReceived{ 0 };
+  std::atomic<long long> numPolls{ 0 };
+  std::atomic<bool> go{ false };
+  std::vector<std::thread> pollers;
+  for (int p = 0; p < numPollers; ++p) {
+    pollers.emplace_back([&] {
+      while (!go.load(std::memory_order_acquire)) {
+      }
+      long long polls = 0;
+      while (numReceived.load(std::memory_order_relaxed) < numPushes) {
+        auto head = stack.pop_all();
+        if (head) {
+          numReceived.fetch_add(head->count(), std::memory_order_relaxed);
+        }
+        ++polls;
+      }
+      numPolls.fetch_add(polls, std::memory_order_relaxed);
+    });
+  }
+  go.store(true, std::memory_order_release);
+  auto const begin = Clock::now();
+  for (auto& node : nodes) {
+    stack.push(&node);
+    auto const spinUntil = Clock::now() + std::chrono::microseconds(1);
+    while (Clock::now() < spinUntil) {
+    }
+  }
+  auto const pushEnd = Clock::now();
+  for (auto& poller : pollers) {
+    poller.join();
+  }
+  auto const end = Clock::now();
+  std::cout << name << " with " << numPollers << " pollers: "
+            << nanosecondsPerOperation(pushEnd - begin, numPushes) << " ns per push (including 1000 ns of pause), "
+            << nanosecondsPerOperation(end - begin, numPolls.load()) * numPollers << " ns per poll\n";
+}
+
+void benchmarkIdlePolling()
+{
+  using UncheckedStack = QwMpmcPopAllLifoStack<lockfree::MessageNode<int>*, lockfree::MessageNode<int>::LINK_INDEX_1>;
+  using CheckedStack = lockfree::LifoStack<int>;
+  int const numPushes = 1 << 16;
+  int const numPollers = std::max(2, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+  std::cout << "===========================================================\n";
+  std::cout << "IDLE POLLING\n";
+  benchmarkIdlePolling<UncheckedStack>("pop_all without empty check", numPollers, numPushes);
+  benchmarkIdlePolling<CheckedStack>("pop_all with empty check", numPollers, numPushes);
+  std::cout << "===========================================================\n\n";
+}
+
+int main()
+{
+  benchmarkLifoStackPolicies();
+  benchmarkIdlePolling();
+}
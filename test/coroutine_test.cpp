@@ -0,0 +1,188 @@
+/*
+Copyright 2021 Dario Mambro
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "lockfree/Coroutines.hpp"
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// a coroutine that starts right away and destroys itself when it completes
+struct DetachedCoroutine
+{
+  struct promise_type
+  {
+    DetachedCoroutine get_return_object()
+    {
+      return {};
+    }
+    std::suspend_never initial_suspend() noexcept
+    {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept
+    {
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception()
+    {
+      std::terminate();
+    }
+  };
+};
+
+// a coroutine that starts right away and is destroyed with its owner, also while suspended
+struct OwnedCoroutine
+{
+  struct promise_type
+  {
+    OwnedCoroutine get_return_object()
+    {
+      return OwnedCoroutine{ std::coroutine_handle<promise_type>::from_promise(*this) };
+    }
+    std::suspend_never initial_suspend() noexcept
+    {
+      return {};
+    }
+    std::suspend_always final_suspend() noexcept
+    {
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception()
+    {
+      std::terminate();
+    }
+  };
+
+  explicit OwnedCoroutine(std::coroutine_handle<promise_type> coroutine)
+    : coroutine{ coroutine }
+  {}
+
+  ~OwnedCoroutine()
+  {
+    coroutine.destroy();
+  }
+
+  OwnedCoroutine(OwnedCoroutine const&) = delete;
+  OwnedCoroutine& operator=(OwnedCoroutine const&) = delete;
+
+  std::coroutine_handle<promise_type> coroutine;
+};
+
+bool testCoroutineReceiver()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING COROUTINE RECEIVER\n";
+  int const numMessages = 1000;
+  auto messenger = lockfree::Messenger<int>();
+  messenger.allocateNodes(numMessages);
+  auto executor = lockfree::CoroutineQueue(4);
+  auto receiver = lockfree::CoroutineReceiver<int>(messenger, executor);
+  auto received = std::vector<int>();
+  bool isDone = false;
+  auto receive = [&]() -> DetachedCoroutine {
+    while (static_cast<int>(received.size()) < numMessages) {
+      auto messages = co_await receiver.receive();
+      lockfree::handleMessageStack(messages, [&](int& message) { received.push_back(message); });
+      messenger.recycle(messages);
+    }
+    isDone = true;
+  };
+  receive();
+  bool success = !isDone && executor.run() == 0;
+  auto sender = std::thread([&] {
+    for (int i = 0; i < numMessages; ++i) {
+      messenger.sendIfNodeAvailable(std::move(i));
+      if (i % 100 == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+  });
+  for (int i = 0; i < 5000 && !isDone; ++i) {
+    if (executor.run() == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  sender.join();
+  success = success && isDone && static_cast<int>(received.size()) == numMessages;
+  for (int i = 0; success && i < numMessages; ++i) {
+    success = received[i] == i;
+  }
+  std::cout << "coroutine receiver test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testNextVersion()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING NEXT VERSION\n";
+  struct Object
+  {
+    explicit Object(int state)
+      : state{ state }
+    {}
+    int state;
+  };
+  auto asyncThread = lockfree::AsyncThread();
+  auto asyncObject = lockfree::AsyncObject<Object, int>::create(0);
+  asyncThread.attachObject(*asyncObject);
+  auto producer = asyncObject->createProducer();
+  auto executor = lockfree::CoroutineQueue(4);
+  auto versions = std::vector<uint64_t>();
+  auto waitForVersions = [&]() -> DetachedCoroutine {
+    for (int i = 0; i < 3; ++i) {
+      versions.push_back(co_await lockfree::nextVersion(*asyncObject, executor));
+    }
+  };
+  waitForVersions();
+  bool success = versions.empty() && asyncObject->getVersion() == 0;
+  for (int i = 1; i <= 3; ++i) {
+    producer->submitChange([i](int& state) { state = i; });
+    success = success && asyncThread.poll();
+    success = success && executor.run() == 1 && versions.size() == static_cast<size_t>(i);
+  }
+  success = success && versions == std::vector<uint64_t>{ 1, 2, 3 } && executor.run() == 0;
+  // a coroutine destroyed while waiting is not resumed
+  bool isResumed = false;
+  auto waitForVersion = [&]() -> OwnedCoroutine {
+    co_await lockfree::nextVersion(*asyncObject, executor);
+    isResumed = true;
+  };
+  {
+    auto const waiting = waitForVersion();
+    success = success && !waiting.coroutine.done();
+  }
+  producer->submitChange([](int& state) { state = 4; });
+  success = success && asyncThread.poll() && executor.run() == 0 && !isResumed && asyncObject->getVersion() == 4;
+  std::cout << "next version test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+int main()
+{
+  bool success = testCoroutineReceiver();
+  success = testNextVersion() && success;
+  return success ? 0 : 1;
+}
@@ -21,16 +21,30 @@ SOFTWARE.
 */
 
 #include "lockfree/AsyncObject.hpp"
+#include "lockfree/Disruptor.hpp"
+#include "lockfree/FifoMessenger.hpp"
+#include "lockfree/MetricsRegistry.hpp"
+#include "lockfree/NodePool.hpp"
+#include "lockfree/PersistentMap.hpp"
+#include "lockfree/Pipeline.hpp"
+#include "lockfree/RealtimeLogger.hpp"
+#include "lockfree/RealtimeRegistry.hpp"
+#include "lockfree/RequestChannel.hpp"
+#include "lockfree/TaskPool.hpp"
+#include "lockfree/Transaction.hpp"
 #include <chrono>
 #include <iostream>
 #include <sstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#endif
 
 class Object final
 {
   int state;
 
 public:
-  int getState()
+  int getState() const
   {
     return state;
   };
@@ -132,9 +146,1422 @@ void test(int numStateChangingThreads, int numGetterThreads)
   std::cout << "===========================================================\n\n\n\n";
 }
 
+bool testInstanceGroup()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING INSTANCE GROUP\n";
+  auto asyncThread = lockfree::AsyncThread(10);
+  auto asyncObject = AsyncObject::create(0);
+  asyncThread.attachObject(*asyncObject);
+  auto producer = asyncObject->createProducer();
+  std::vector<std::unique_ptr<AsyncObject::Instance>> instances;
+  auto group = lockfree::InstanceGroup(8);
+  for (int i = 0; i < 4; ++i) {
+    instances.push_back(asyncObject->createInstance());
+    group.add(*instances.back());
+  }
+  bool success = group.getNumMembers() == 4;
+  group.update();
+  success = success && group.update() == 0;
+  asyncThread.start();
+  producer->submitChange([](int& state) { state = 42; });
+  int numUpdated = 0;
+  for (int i = 0; i < 200 && numUpdated < 4; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    numUpdated += group.update();
+  }
+  asyncThread.stop();
+  success = success && numUpdated == 4 && group.update() == 0;
+  for (auto& instance : instances) {
+    success = success && instance->get().getState() == 42;
+  }
+  instances.pop_back();
+  success = success && group.getNumMembers() == 3;
+  std::cout << "instance group test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testImplicitProducers()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING IMPLICIT PRODUCERS\n";
+  auto asyncThread = lockfree::AsyncThread(10);
+  auto asyncObject = AsyncObject::create(0);
+  asyncThread.attachObject(*asyncObject);
+  auto instance = asyncObject->createInstance();
+  asyncThread.start();
+  int const numThreads = 4;
+  int const numChangesPerThread = 10;
+  std::atomic<bool> runSnapshotReader{ true };
+  bool isSnapshotMonotonic = true;
+  auto snapshotReader = std::thread([&] {
+    int prevState = 0;
+    while (runSnapshotReader) {
+      int const state = *asyncObject->settingsSnapshot();
+      isSnapshotMonotonic = isSnapshotMonotonic && state >= prevState;
+      prevState = state;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  std::vector<std::thread> threads;
+  for (int t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < numChangesPerThread; ++i) {
+        asyncObject->submitChange([](int& state) { state += 1; });
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  int const expectedState = numThreads * numChangesPerThread;
+  for (int i = 0; i < 200 && instance->get().getState() != expectedState; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    instance->update();
+  }
+  asyncThread.stop();
+  runSnapshotReader = false;
+  snapshotReader.join();
+  bool const success = instance->get().getState() == expectedState &&
+                       *asyncObject->settingsSnapshot() == expectedState && isSnapshotMonotonic;
+  std::cout << "implicit producers test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+class ObjectFromMoveOnlySettings final
+{
+  int state;
+
+public:
+  int getState() const
+  {
+    return state;
+  }
+  explicit ObjectFromMoveOnlySettings(std::unique_ptr<int> const& settings)
+    : state(settings ? *settings : 0)
+  {}
+};
+
+bool testMoveOnlySettings()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING MOVE ONLY SETTINGS\n";
+  auto asyncThread = lockfree::AsyncThread(10);
+  auto asyncObject = lockfree::AsyncObject<ObjectFromMoveOnlySettings, std::unique_ptr<int>>::create(nullptr);
+  asyncThread.attachObject(*asyncObject);
+  auto instance = asyncObject->createInstance();
+  asyncThread.start();
+  asyncObject->submitChange([](std::unique_ptr<int>& settings) { settings = std::make_unique<int>(42); });
+  for (int i = 0; i < 200 && instance->get().getState() != 42; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    instance->update();
+  }
+  asyncThread.stop();
+  bool const success = instance->get().getState() == 42;
+  std::cout << "move only settings test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testSnapshotPublisher()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING SNAPSHOT PUBLISHER\n";
+  auto publisher = lockfree::SnapshotPublisher<int>(std::make_shared<int const>(0));
+  std::atomic<bool> isReading{ true };
+  std::atomic<bool> isMonotonic{ true };
+  auto readers = std::vector<std::thread>();
+  for (int i = 0; i < 3; ++i) {
+    readers.emplace_back([&] {
+      int last = 0;
+      while (isReading.load()) {
+        int const value = *publisher.get();
+        if (value < last) {
+          isMonotonic = false;
+        }
+        last = value;
+      }
+    });
+  }
+  // the replaced snapshots are freed while the readers keep reading
+  int maxNumRetired = 0;
+  for (int i = 1; i <= 1000; ++i) {
+    publisher.publish(std::make_shared<int const>(i));
+    maxNumRetired = std::max(maxNumRetired, publisher.reclaim());
+  }
+  isReading = false;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  publisher.reclaim();
+  bool const success = isMonotonic && *publisher.get() == 1000 && publisher.reclaim() == 0 && maxNumRetired < 1000;
+  std::cout << "snapshot publisher test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testTransaction()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING TRANSACTION\n";
+  auto first = lockfree::RealtimeObject<Object>(std::make_unique<Object>(0));
+  auto second = lockfree::RealtimeObject<Object>(std::make_unique<Object>(0));
+  auto channel = lockfree::TransactionChannel{};
+  std::atomic<bool> run{ true };
+  std::atomic<bool> consistent{ true };
+  std::atomic<uint64_t> lastVersionSeen{ 0 };
+  auto realtimeThread = std::thread([&] {
+    while (run) {
+      lastVersionSeen = channel.receiveChangesOnRealtimeThread();
+      if (first.getOnRealtimeThread()->getState() != second.getOnRealtimeThread()->getState()) {
+        consistent = false;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+  uint64_t lastVersionCommitted = 0;
+  for (int i = 1; i <= 100; ++i) {
+    auto transaction = lockfree::Transaction(channel);
+    transaction.set(first, std::make_unique<Object>(i));
+    transaction.change(second, [](Object const& object) { return std::make_unique<Object>(object.getState() + 1); });
+    lastVersionCommitted = transaction.commit();
+  }
+  for (int i = 0; i < 200 && lastVersionSeen != lastVersionCommitted; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  run = false;
+  realtimeThread.join();
+  bool success = consistent && lastVersionSeen == 100 && first.getOnNonRealtimeThread()->getState() == 100 &&
+                 second.getOnRealtimeThread()->getState() == 100;
+  // concurrent commits leave the last object on the non real-time thread as the one of the last bundle
+  run = true;
+  realtimeThread = std::thread([&] {
+    while (run) {
+      lastVersionSeen = channel.receiveChangesOnRealtimeThread();
+      if (first.getOnRealtimeThread()->getState() != second.getOnRealtimeThread()->getState()) {
+        consistent = false;
+      }
+      std::this_thread::yield();
+    }
+  });
+  auto committers = std::vector<std::thread>();
+  for (int i = 0; i < 2; ++i) {
+    committers.emplace_back([&, i] {
+      for (int j = 0; j < 100; ++j) {
+        auto transaction = lockfree::Transaction(channel);
+        int const state = 1000 * (i + 1) + j;
+        transaction.set(first, std::make_unique<Object>(state));
+        transaction.set(second, std::make_unique<Object>(state));
+        transaction.commit();
+      }
+    });
+  }
+  for (auto& committer : committers) {
+    committer.join();
+  }
+  lastVersionCommitted = channel.getLastCommittedVersion();
+  for (int i = 0; i < 200 && lastVersionSeen != lastVersionCommitted; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  run = false;
+  realtimeThread.join();
+  success = success && consistent && lastVersionSeen == 300 &&
+            first.getOnNonRealtimeThread()->getState() == first.getOnRealtimeThread()->getState() &&
+            second.getOnNonRealtimeThread()->getState() == second.getOnRealtimeThread()->getState();
+  std::cout << "transaction test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testPersistentMap()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING PERSISTENT MAP\n";
+  // a bad hash, so that both shared slots and full collisions are exercised
+  struct BadHash
+  {
+    size_t operator()(int key) const
+    {
+      return key < 1000 ? static_cast<size_t>(key % 97) : 0;
+    }
+  };
+  using Map = lockfree::PersistentMap<int, int, BadHash>;
+  auto map = Map{};
+  for (int i = 0; i < 1100; ++i) {
+    map = map.set(i, i);
+  }
+  auto const snapshot = map;
+  for (int i = 0; i < 1100; i += 2) {
+    map = map.erase(i);
+  }
+  map = map.set(1, -1).update(3, [](int value) { return value * 10; });
+  bool success = snapshot.size() == 1100 && map.size() == 550 && snapshot.isSameVersion(Map(snapshot));
+  for (int i = 0; i < 1100; ++i) {
+    auto const value = map.find(i);
+    int const expected = i == 1 ? -1 : i == 3 ? 30 : i;
+    success = success && snapshot.find(i) && *snapshot.find(i) == i;
+    success = success && (i % 2 == 0 ? value == nullptr : value && *value == expected);
+  }
+  int sum = 0;
+  map.forEach([&](int, int value) { sum += value; });
+  success = success && sum == 550 * 550 - 1 - 1 + 30 - 3;
+  for (int i = 1; i < 1100; i += 2) {
+    map = map.erase(i);
+  }
+  success = success && map.empty() && !map.contains(1);
+  std::cout << "persistent map test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+struct SynthSettings : lockfree::TrackedSettings
+{
+  enum Fields : lockfree::SettingsFields
+  {
+    waveformField = 1,
+    cutoffField = 2
+  };
+  int waveform{ 0 };
+  int cutoff{ 0 };
+};
+
+struct WaveTable
+{
+  int waveform;
+};
+
+struct FilterCoefficients
+{
+  int cutoff;
+};
+
+class Synth final
+{
+public:
+  Synth(SynthSettings const&, lockfree::Components<SynthSettings> const& components)
+    : waveTable{ components.get<WaveTable>() }
+    , filterCoefficients{ components.get<FilterCoefficients>() }
+  {}
+
+  std::shared_ptr<WaveTable const> waveTable;
+  std::shared_ptr<FilterCoefficients const> filterCoefficients;
+};
+
+bool testComponents()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING COMPONENTS\n";
+  using AsyncSynth = lockfree::AsyncObject<Synth, SynthSettings>;
+  auto asyncThread = lockfree::AsyncThread(10);
+  auto asyncSynth = AsyncSynth::create(SynthSettings{});
+  int numWaveTableBuilds = 0;
+  int numFilterBuilds = 0;
+  asyncSynth->addComponent<WaveTable>(SynthSettings::waveformField, [&](SynthSettings const& settings) {
+    ++numWaveTableBuilds;
+    return WaveTable{ settings.waveform };
+  });
+  asyncSynth->addComponent<FilterCoefficients>(SynthSettings::cutoffField, [&](SynthSettings const& settings) {
+    ++numFilterBuilds;
+    return FilterCoefficients{ settings.cutoff };
+  });
+  asyncThread.attachObject(*asyncSynth);
+  auto instance = asyncSynth->createInstance();
+  auto const firstWaveTable = instance->get().waveTable;
+  asyncThread.start();
+  asyncSynth->submitChange([](SynthSettings& settings) {
+    settings.cutoff = 1000;
+    settings.markChanged(SynthSettings::cutoffField);
+  });
+  bool isUpdated = false;
+  for (int i = 0; i < 200 && !isUpdated; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    isUpdated = instance->update();
+  }
+  asyncThread.stop();
+  auto& synth = instance->get();
+  bool const success = isUpdated && numWaveTableBuilds == 1 && numFilterBuilds == 2 &&
+                       synth.waveTable == firstWaveTable && synth.filterCoefficients->cutoff == 1000;
+  std::cout << "components test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testExternallyDrivenAsyncThread()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING EXTERNALLY DRIVEN ASYNC THREAD\n";
+  auto asyncThread = lockfree::AsyncThread();
+  auto asyncObject = AsyncObject::create(0);
+  asyncThread.attachObject(*asyncObject);
+  auto instance = asyncObject->createInstance();
+  auto producer = asyncObject->createProducer();
+  auto isFdReadable = [&](int timeoutMs) {
+#if defined(__unix__) || defined(__APPLE__)
+    auto pollFd = pollfd{ asyncThread.getNotificationFd(), POLLIN, 0 };
+    return ::poll(&pollFd, 1, timeoutMs) == 1;
+#else
+    return true;
+#endif
+  };
+  asyncThread.poll();
+  bool success = !isFdReadable(0);
+  std::thread([&] { producer->submitChange([](int& state) { state = 7; }); }).join();
+  success = success && isFdReadable(1000);
+  success = success && asyncThread.runFor(std::chrono::milliseconds(10));
+  success = success && !isFdReadable(0) && !asyncThread.poll();
+  success = success && instance->update() && instance->get().getState() == 7;
+  // a thread submitting changes never notifies an AsyncThread the object has been detached from and that is destroyed
+  std::atomic<bool> isSubmitting{ true };
+  auto submitter = std::thread([&] {
+    auto submittingProducer = asyncObject->createProducer();
+    for (int i = 0; isSubmitting.load(); ++i) {
+      submittingProducer->submitChange([i](int& state) { state = i; });
+    }
+  });
+  for (int i = 0; i < 100; ++i) {
+    auto temporaryThread = lockfree::AsyncThread();
+    temporaryThread.attachObject(*asyncObject);
+    temporaryThread.poll();
+    temporaryThread.detachObject(*asyncObject);
+  }
+  isSubmitting = false;
+  submitter.join();
+  std::cout << "externally driven async thread test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testTimerWheel()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING TIMER WHEEL\n";
+  struct Timer : lockfree::TimerWheelNode
+  {
+    uint64_t expectedDeadline{ 0 };
+    int numExpirations{ 0 };
+  };
+  auto wheel = lockfree::TimerWheel(1000);
+  std::vector<Timer> timers(2000);
+  uint64_t seed = 12345;
+  for (auto& timer : timers) {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    // spread over all the levels of the wheel, and beyond
+    timer.expectedDeadline = 1001 + (seed >> 40) % (uint64_t{ 1 } << (1 + (seed >> 20) % 26));
+    wheel.schedule(timer, timer.expectedDeadline);
+  }
+  wheel.cancel(timers[0]);
+  bool success = wheel.getNumScheduledNodes() == 1999;
+  uint64_t lastTick = 0;
+  for (uint64_t tick = 1000; wheel.getNumScheduledNodes() > 0; tick += 1 + tick / 3) {
+    wheel.advance(tick, [&](lockfree::TimerWheelNode& node) {
+      auto& timer = static_cast<Timer&>(node);
+      ++timer.numExpirations;
+      success = success && wheel.getCurrentTick() == timer.expectedDeadline && timer.expectedDeadline > lastTick;
+    });
+    lastTick = tick;
+  }
+  for (size_t i = 1; i < timers.size(); ++i) {
+    success = success && timers[i].numExpirations == 1;
+  }
+  success = success && timers[0].numExpirations == 0;
+  std::cout << "timer wheel test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testPerObjectUpdatePeriods()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING PER OBJECT UPDATE PERIODS\n";
+  auto asyncThread = lockfree::AsyncThread(5000);
+  auto fastObject = AsyncObject::create(0);
+  auto slowObject = AsyncObject::create(0);
+  asyncThread.attachObject(*fastObject);
+  asyncThread.attachObject(*slowObject);
+  asyncThread.setUpdatePeriod(*fastObject, 5);
+  auto fastInstance = fastObject->createInstance();
+  auto slowInstance = slowObject->createInstance();
+  asyncThread.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  fastObject->submitChange([](int& state) { state = 1; });
+  slowObject->submitChange([](int& state) { state = 1; });
+  bool isFastUpdated = false;
+  for (int i = 0; i < 200 && !isFastUpdated; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    isFastUpdated = fastInstance->update();
+  }
+  bool const isSlowUpdated = slowInstance->update();
+  asyncThread.stop();
+  bool const success = isFastUpdated && !isSlowUpdated && asyncThread.getUpdatePeriod(*fastObject) == 5 &&
+                       asyncThread.getUpdatePeriod(*slowObject) == 5000;
+  std::cout << "per object update periods test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testAdaptiveUpdatePeriod()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING ADAPTIVE UPDATE PERIOD\n";
+  auto asyncThread = lockfree::AsyncThread(64);
+  auto asyncObject = AsyncObject::create(0);
+  auto ownPeriodObject = AsyncObject::create(0);
+  asyncThread.attachObject(*asyncObject);
+  asyncThread.attachObject(*ownPeriodObject);
+  asyncThread.setUpdatePeriod(*ownPeriodObject, 1);
+  asyncThread.setAdaptiveUpdatePeriod({ 2, 64, 500 });
+  asyncThread.start();
+  // changes to an object with its own period do not shrink the period of the others
+  for (int i = 0; i < 200; ++i) {
+    ownPeriodObject->submitChange([i](int& state) { state = i; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  int const ownPeriodBusyPeriod = asyncThread.getEffectiveUpdatePeriod();
+  for (int i = 0; i < 200; ++i) {
+    asyncObject->submitChange([i](int& state) { state = i; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  int const busyPeriod = asyncThread.getEffectiveUpdatePeriod();
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  int const idlePeriod = asyncThread.getEffectiveUpdatePeriod();
+  asyncThread.stop();
+  asyncThread.disableAdaptiveUpdatePeriod();
+  bool const success = ownPeriodBusyPeriod == 64 && busyPeriod < 64 && idlePeriod > busyPeriod &&
+                       asyncThread.getEffectiveUpdatePeriod() == 64 && asyncThread.getRebuildTime().count() > 0;
+  std::cout << "period while an object with its own period is busy: " << ownPeriodBusyPeriod
+            << " ms, period while busy: " << busyPeriod << " ms, period while idle: " << idlePeriod << " ms\n";
+  std::cout << "adaptive update period test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testDeadlineScheduling()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING DEADLINE SCHEDULING\n";
+  auto asyncThread = lockfree::AsyncThread();
+  auto bulkObject = AsyncObject::create(0);
+  auto urgentObject = AsyncObject::create(0);
+  asyncThread.attachObject(*bulkObject);
+  asyncThread.attachObject(*urgentObject);
+  asyncThread.setLatencyTarget(*bulkObject, 1000);
+  asyncThread.setLatencyTarget(*urgentObject, 1);
+  std::vector<int> handlingOrder;
+  handlingOrder.reserve(2);
+  bulkObject->submitChange([&](int& state) { handlingOrder.push_back(state = 1); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  urgentObject->submitChange([&](int& state) { handlingOrder.push_back(state = 2); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  asyncThread.poll();
+  bool const success = handlingOrder == std::vector<int>{ 2, 1 } &&
+                       asyncThread.getNumDeadlineMisses(*urgentObject) == 1 &&
+                       asyncThread.getNumDeadlineMisses(*bulkObject) == 0 && asyncThread.getNumDeadlineMisses() == 1;
+  std::cout << "deadline scheduling test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testThreadConfiguration()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING THREAD CONFIGURATION\n";
+  bool success = true;
+#if defined(__linux__)
+  auto asyncThread = lockfree::AsyncThread(1);
+  auto asyncObject = AsyncObject::create(0);
+  asyncThread.attachObject(*asyncObject);
+  auto configuration = lockfree::ThreadConfiguration{};
+  // a cpu the process is allowed to run on, as containers and cpusets may exclude cpu 0
+  cpu_set_t allowedCpus;
+  CPU_ZERO(&allowedCpus);
+  sched_getaffinity(0, sizeof(allowedCpus), &allowedCpus);
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowedCpus)) {
+      configuration.cpus = { cpu };
+      break;
+    }
+  }
+  configuration.schedulingPolicy = lockfree::ThreadConfiguration::SchedulingPolicy::batch;
+  configuration.setNiceLevel = true;
+  configuration.niceLevel = 5;
+  configuration.name = "lockfree-async-thread";
+  asyncThread.setThreadConfiguration(configuration);
+  success = asyncThread.start();
+  std::atomic<bool> isConfigured{ false };
+  asyncObject->submitChange([&](int&) {
+    char name[16] = {};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    isConfigured = std::string(name) == "lockfree-async-" && sched_getscheduler(0) == SCHED_BATCH &&
+                   getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid))) == 5;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  asyncThread.stop();
+  success = success && isConfigured;
+  // an invalid configuration is reported, and the thread starts anyway
+  configuration.cpus = { -1 };
+  asyncThread.setThreadConfiguration(configuration);
+  success = success && !asyncThread.start() && asyncThread.isRunning() &&
+            asyncThread.getThreadConfigurationResult().affinityError == EINVAL &&
+            asyncThread.getThreadConfigurationResult().nameError == 0;
+  asyncThread.stop();
+#endif
+  std::cout << "thread configuration test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testAsyncThreadStats()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING ASYNC THREAD STATS\n";
+  auto asyncThread = lockfree::AsyncThread();
+  auto asyncObject = AsyncObject::create(0);
+  auto idleObject = AsyncObject::create(0);
+  asyncThread.attachObject(*asyncObject);
+  asyncThread.attachObject(*idleObject);
+  auto instance = asyncObject->createInstance();
+  auto otherInstance = asyncObject->createInstance();
+  for (int i = 1; i <= 3; ++i) {
+    asyncObject->submitChange([i](int& state) { state = i; });
+  }
+  asyncThread.poll();
+  instance->update();
+  otherInstance->update();
+  asyncThread.poll();
+  auto const stats = asyncThread.stats();
+  auto const objectStats =
+    std::find_if(stats->objects.begin(), stats->objects.end(), [&](lockfree::AsyncThread::ObjectStats const& element) {
+      return element.asyncObject == asyncObject.get();
+    });
+  bool const success = stats->objects.size() == 2 && objectStats != stats->objects.end() &&
+                       objectStats->numCallbacks == 2 && objectStats->numChangesHandled == 3 &&
+                       objectStats->numObjectsBuilt == 2 && objectStats->numPendingChanges == 0 &&
+                       objectStats->maxNumPendingChanges == 3 && objectStats->numPickups == 2 &&
+                       objectStats->maxPickupDelay.count() > 0 && objectStats->callbackTime.count() > 0 &&
+                       instance->get().getState() == 3;
+  std::cout << "async thread stats test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testDeferredDeleter()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING DEFERRED DELETER\n";
+  struct Counted final
+  {
+    int* numDestroyed;
+    ~Counted()
+    {
+      ++*numDestroyed;
+    }
+  };
+  int numDestroyed = 0;
+  auto deleter = lockfree::DeferredDeleter<>::create(2);
+  auto first = std::make_shared<Counted>(Counted{ &numDestroyed });
+  auto second = std::vector<std::unique_ptr<Counted>>();
+  second.push_back(std::make_unique<Counted>(Counted{ &numDestroyed }));
+  auto third = std::make_unique<Counted>(Counted{ &numDestroyed });
+  numDestroyed = 0;
+  bool success = deleter->deferIfNodeAvailable(std::move(first)) && deleter->deferIfNodeAvailable(std::move(second));
+  success = success && !deleter->deferIfNodeAvailable(std::move(third)) && third && numDestroyed == 0;
+  success = success && deleter->collect() == 2 && numDestroyed == 2 && deleter->getNumNodes() == 2;
+  // attached to an AsyncThread, and shared by a RealtimeObject
+  auto asyncThread = lockfree::AsyncThread();
+  asyncThread.attachObject(*deleter);
+  auto realtimeObject = lockfree::RealtimeObject<Counted>(std::move(third), deleter);
+  realtimeObject.set(std::make_unique<Counted>(Counted{ &numDestroyed }));
+  realtimeObject.set(std::make_unique<Counted>(Counted{ &numDestroyed }));
+  numDestroyed = 0;
+  realtimeObject.receiveChangesOnRealtimeThread();
+  success = success && numDestroyed == 0;
+  asyncThread.poll();
+  success = success && numDestroyed == 2;
+  // shared by several threads, which never find the nodes taken by each other
+  int const numThreads = 4;
+  int const numObjectsPerThread = 200;
+  auto sharedDeleter = lockfree::DeferredDeleter<>::create(numThreads * numObjectsPerThread);
+  std::atomic<int> numRejected{ 0 };
+  auto threads = std::vector<std::thread>();
+  for (int i = 0; i < numThreads; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < numObjectsPerThread; ++j) {
+        if (!sharedDeleter->deferIfNodeAvailable(std::make_unique<int>(j))) {
+          ++numRejected;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  success = success && numRejected.load() == 0 && sharedDeleter->collect() == numThreads * numObjectsPerThread;
+  std::cout << "deferred deleter test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testRealtimeLogger()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING REALTIME LOGGER\n";
+  enum class Color
+  {
+    red,
+    green
+  };
+  auto output = std::ostringstream();
+  auto logger = lockfree::RealtimeLogger<>::create(output, 3);
+  bool success = logger->log("block {} of {}: gain {}", 1, 16u, 0.5);
+  success = logger->log("{} is {}", "color", Color::green) && success;
+  success = logger->log("no arguments, {}") && success;
+  success = !logger->log("dropped {}", true) && success;
+  success = logger->flush() == 3 && logger->getNumDroppedRecords() == 1 && success;
+  auto const text = output.str();
+  success = success && text.find("] block 1 of 16: gain 0.5\n") != std::string::npos &&
+            text.find("] color is 1\n") != std::string::npos &&
+            text.find("] no arguments, {}\n") != std::string::npos &&
+            text.find("1 records dropped\n") != std::string::npos &&
+            text.find("block") < text.find("color") && text.find("color") < text.find("no arguments");
+  std::cout << text;
+  // attached to an AsyncThread, which flushes it
+  auto asyncThread = lockfree::AsyncThread();
+  asyncThread.attachObject(*logger);
+  success = logger->log("flushed by the AsyncThread") && success;
+  asyncThread.poll();
+  success = success && output.str().find("] flushed by the AsyncThread\n") != std::string::npos;
+  // several realtime threads logging at once never find the nodes taken by each other
+  int const numThreads = 4;
+  int const numRecordsPerThread = 200;
+  auto sharedOutput = std::ostringstream();
+  auto sharedLogger = lockfree::RealtimeLogger<>::create(sharedOutput, numThreads * numRecordsPerThread);
+  auto threads = std::vector<std::thread>();
+  for (int i = 0; i < numThreads; ++i) {
+    threads.emplace_back([&, i] {
+      for (int j = 0; j < numRecordsPerThread; ++j) {
+        sharedLogger->log("thread {} record {}", i, j);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  success = success && sharedLogger->getNumDroppedRecords() == 0 &&
+            sharedLogger->flush() == numThreads * numRecordsPerThread;
+  std::cout << "realtime logger test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testMetricsRegistry()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING METRICS REGISTRY\n";
+  auto registry = lockfree::MetricsRegistry(4, 32);
+  auto const xruns = *registry.addCounter("xruns");
+  auto const voices = *registry.addGauge("voices");
+  auto const peakLoad = *registry.addGauge("peak_load", lockfree::MetricsRegistry::GaugeAggregation::max);
+  auto const blockTime = *registry.addHistogram("block_time", { 0.5, 1.0 });
+  bool success = !registry.addHistogram("too_big", std::vector<double>(32, 0.0));
+  int const numThreads = 3;
+  int const numBlocks = 10000;
+  auto threads = std::vector<std::thread>();
+  for (int i = 0; i < numThreads; ++i) {
+    threads.emplace_back([&, i] {
+      auto slot = *registry.registerThread();
+      for (int block = 0; block < numBlocks; ++block) {
+        slot.add(xruns);
+        slot.set(voices, 2.0);
+        slot.set(peakLoad, static_cast<double>(i));
+        slot.record(blockTime, block % 3 == 0 ? 0.25 : 2.0);
+      }
+    });
+  }
+  auto const text = registry.exportText();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto const histogram = registry.read(blockTime);
+  success = success && registry.read(xruns) == numThreads * numBlocks && registry.read(voices) == 2.0 * numThreads &&
+            registry.read(peakLoad) == numThreads - 1 && histogram.count == numThreads * numBlocks &&
+            histogram.bucketCounts[0] == numThreads * 3334 && histogram.bucketCounts[1] == 0 &&
+            histogram.bucketCounts[2] == numThreads * 6666;
+  auto const finalText = registry.exportText();
+  std::cout << finalText;
+  success = success && finalText.find("xruns 30000\n") != std::string::npos &&
+            finalText.find("block_time_bucket{le=\"1\"} 10002\n") != std::string::npos &&
+            finalText.find("block_time_bucket{le=\"+Inf\"} 30000\n") != std::string::npos &&
+            text.find("# TYPE block_time histogram\n") != std::string::npos;
+  std::cout << "metrics registry test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testRequestChannel()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING REQUEST CHANNEL\n";
+  using Channel = lockfree::RequestChannel<int, std::unique_ptr<int>>;
+  auto const square = [](int& request, std::unique_ptr<int>& reply) {
+    reply = std::make_unique<int>(request * request);
+  };
+  auto channel = Channel::create(2);
+  auto first = channel->submit(2);
+  auto second = channel->submit(3);
+  int third = 4;
+  auto noSlot = channel->submit(std::move(third));
+  bool success = first.isValid() && second.isValid() && !noSlot.isValid() && !first.isReady();
+  success = success && channel->serve(square) == 2 && first.isReady() && second.isReady() &&
+            *first.getReply() == 4 && *second.getReply() == 9;
+  first.release();
+  second.release();
+  // a request abandoned before its reply returns its slot after the reply
+  auto abandoned = channel->submit(5);
+  abandoned.release();
+  success = success && channel->serve(square) == 1;
+  auto again = channel->submit(6);
+  auto andAgain = channel->submit(7);
+  success = success && again.isValid() && andAgain.isValid() && channel->serve(square) == 2 &&
+            *andAgain.getReply() == 49;
+  again.release();
+  andAgain.release();
+  // a handle keeps the channel alive
+  auto outliving = channel->submit(8);
+  auto weakChannel = std::weak_ptr<Channel>(channel);
+  channel.reset();
+  success = success && !weakChannel.expired() && outliving.isValid();
+  outliving.release();
+  success = success && weakChannel.expired();
+  // concurrent submitters never find the slots taken by each other
+  int const numSubmitters = 4;
+  int const numRequestsPerSubmitter = 200;
+  auto sharedChannel = Channel::create(numSubmitters * numRequestsPerSubmitter);
+  std::atomic<int> numRejected{ 0 };
+  auto handles = std::vector<std::vector<Channel::Handle>>(numSubmitters);
+  auto submitters = std::vector<std::thread>();
+  for (int i = 0; i < numSubmitters; ++i) {
+    submitters.emplace_back([&, i] {
+      for (int j = 0; j < numRequestsPerSubmitter; ++j) {
+        handles[i].push_back(sharedChannel->submit(int{ j }));
+        if (!handles[i].back().isValid()) {
+          ++numRejected;
+        }
+      }
+    });
+  }
+  for (auto& submitter : submitters) {
+    submitter.join();
+  }
+  success = success && numRejected.load() == 0 &&
+            sharedChannel->serve(square) == numSubmitters * numRequestsPerSubmitter;
+  handles.clear();
+  // served by an AsyncThread
+  auto asyncThread = lockfree::AsyncThread(1);
+  auto servedChannel = Channel::create(16, square);
+  asyncThread.attachObject(*servedChannel);
+  asyncThread.start();
+  int numReplies = 0;
+  std::thread([&] {
+    for (int i = 0; i < 100; ++i) {
+      auto handle = servedChannel->submit(int{ i });
+      while (!handle.isReady()) {
+        std::this_thread::yield();
+      }
+      if (*handle.getReply() == i * i) {
+        ++numReplies;
+      }
+    }
+  }).join();
+  asyncThread.stop();
+  success = success && numReplies == 100;
+  std::cout << "request channel test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testTaskPool()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING TASK POOL\n";
+  // work-stealing deque: each element is taken exactly once
+  int const numElements = 100000;
+  auto elements = std::vector<int>(numElements);
+  auto numTaken = std::vector<std::atomic<int>>(numElements);
+  auto deque = lockfree::WorkStealingDeque<int>(64);
+  std::atomic<bool> isPushing{ true };
+  auto thieves = std::vector<std::thread>();
+  for (int i = 0; i < 2; ++i) {
+    thieves.emplace_back([&] {
+      while (isPushing.load()) {
+        if (auto element = deque.steal()) {
+          ++numTaken[element - elements.data()];
+        }
+      }
+    });
+  }
+  for (int i = 0; i < numElements; ++i) {
+    while (!deque.push(&elements[i])) {
+      if (auto element = deque.pop()) {
+        ++numTaken[element - elements.data()];
+      }
+    }
+    if (i % 3 == 0) {
+      if (auto element = deque.pop()) {
+        ++numTaken[element - elements.data()];
+      }
+    }
+  }
+  while (auto element = deque.pop()) {
+    ++numTaken[element - elements.data()];
+  }
+  isPushing = false;
+  for (auto& thief : thieves) {
+    thief.join();
+  }
+  bool success = std::all_of(numTaken.begin(), numTaken.end(), [](std::atomic<int>& n) { return n.load() == 1; });
+  // tasks submitted from a thread that does not allocate, with their completions
+  std::atomic<int> sum{ 0 };
+  int numCompleted = 0;
+  uint64_t tagSum = 0;
+  {
+    auto pool = lockfree::TaskPool<>(2, 64);
+    auto completions = lockfree::TaskPool<>::CompletionQueue(64);
+    std::thread([&] {
+      for (int i = 1; i <= 50; ++i) {
+        success = pool.submitIfNodeAvailable([&sum, i] { sum += i; }, &completions, i) && success;
+      }
+      while (numCompleted < 50) {
+        numCompleted += completions.receive([&](uint64_t tag) { tagSum += tag; });
+        std::this_thread::yield();
+      }
+    }).join();
+    pool.submit([&sum] { sum += 1000; });
+    for (int i = 0; i < 1000 && sum.load() != 2275; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  success = success && sum.load() == 2275 && numCompleted == 50 && tagSum == 1275;
+  // several threads submitting at once never find the nodes taken by each other
+  int const numSubmitters = 4;
+  int const numTasksPerSubmitter = 200;
+  std::atomic<int> numRun{ 0 };
+  std::atomic<int> numRejected{ 0 };
+  {
+    auto pool = lockfree::TaskPool<>(2, numSubmitters * numTasksPerSubmitter);
+    auto submitters = std::vector<std::thread>();
+    for (int i = 0; i < numSubmitters; ++i) {
+      submitters.emplace_back([&] {
+        for (int j = 0; j < numTasksPerSubmitter; ++j) {
+          if (!pool.submitIfNodeAvailable([&numRun] { ++numRun; })) {
+            ++numRejected;
+          }
+        }
+      });
+    }
+    for (auto& submitter : submitters) {
+      submitter.join();
+    }
+    for (int i = 0; i < 1000 && numRun.load() != numSubmitters * numTasksPerSubmitter; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  success = success && numRejected.load() == 0 && numRun.load() == numSubmitters * numTasksPerSubmitter;
+  std::cout << "task pool test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testFifoMessenger()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING FIFO MESSENGER\n";
+  int const numProducers = 3;
+  int const numConsumers = 3;
+  int const numMessagesPerProducer = 20000;
+  auto messenger = lockfree::FifoMessenger<int>(256);
+  auto numReceived = std::vector<std::atomic<int>>(numProducers * numMessagesPerProducer);
+  std::atomic<bool> isInOrder{ true };
+  std::atomic<int> numProducing{ numProducers };
+  auto threads = std::vector<std::thread>();
+  for (int producer = 0; producer < numProducers; ++producer) {
+    threads.emplace_back([&, producer] {
+      for (int i = 0; i < numMessagesPerProducer; ++i) {
+        int message = producer * numMessagesPerProducer + i;
+        if (i % 2 == 0) {
+          messenger.send(std::move(message));
+        }
+        else {
+          while (!messenger.sendIfNodeAvailable(std::move(message))) {
+            std::this_thread::yield();
+          }
+        }
+      }
+      --numProducing;
+    });
+  }
+  for (int consumer = 0; consumer < numConsumers; ++consumer) {
+    threads.emplace_back([&] {
+      // messages from the same producer are received in the order they were sent
+      auto lastReceived = std::vector<int>(numProducers, -1);
+      while (numProducing.load() > 0 || !messenger.empty()) {
+        auto message = messenger.receive();
+        if (!message) {
+          std::this_thread::yield();
+          continue;
+        }
+        ++numReceived[*message];
+        auto& last = lastReceived[*message / numMessagesPerProducer];
+        if (*message <= last) {
+          isInOrder = false;
+        }
+        last = *message;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  bool success =
+    isInOrder.load() &&
+    std::all_of(numReceived.begin(), numReceived.end(), [](std::atomic<int>& n) { return n.load() == 1; });
+  // messages received by a single consumer come out in the order they were sent
+  auto sent = std::vector<int>{ 1, 2, 3, 4, 5 };
+  for (int message : sent) {
+    success = messenger.sendIfNodeAvailable(std::move(message)) && success;
+  }
+  auto received = std::vector<int>();
+  success = messenger.receive(3, [&](int& message) { received.push_back(message); }) == 3 && success;
+  success = messenger.receive(10, [&](int& message) { received.push_back(message); }) == 2 && success;
+  success = success && received == sent && !messenger.receive() && messenger.empty();
+  // no more than maxNumNodes nodes are allocated, one of which is the dummy node
+  int const maxNumMessages = lockfree::FifoMessenger<int>::maxNumNodes - 1;
+  auto full = lockfree::FifoMessenger<int>();
+  success = success && full.allocateNodes(maxNumMessages + 1) == maxNumMessages;
+  for (int i = 0; i < maxNumMessages; ++i) {
+    success = full.sendIfNodeAvailable(int{ i }) && success;
+  }
+  int rejected = -1;
+  success = success && !full.send(std::move(rejected)) && full.receive() == 0 && full.send(std::move(rejected));
+  std::cout << "fifo messenger test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testPipeline()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING PIPELINE\n";
+  struct Message
+  {
+    int value{ 0 };
+    Message* origin{ nullptr };
+  };
+  int const numMessages = 2000;
+  std::atomic<int> numReceived{ 0 };
+  int64_t sum = 0;
+  bool isInOrder = true;
+  bool isNeverCopied = true;
+  int lastValue = -1;
+  bool success = true;
+  {
+    auto pipeline = lockfree::Pipeline<Message>(16);
+    pipeline
+      .addStage([](Message& message) { message.value *= 2; }, 4)
+      .addStage(
+        [](Message& message) {
+          // a slow stage, to make the first one wait
+          std::this_thread::sleep_for(std::chrono::microseconds(20));
+          message.value += 1;
+        },
+        2)
+      .addStage(
+        [&](Message& message) {
+          isInOrder = isInOrder && message.value > lastValue;
+          isNeverCopied = isNeverCopied && message.origin == &message;
+          lastValue = message.value;
+          sum += message.value;
+          ++numReceived;
+        },
+        4)
+      .start();
+    std::thread([&] {
+      for (int i = 0; i < numMessages; ++i) {
+        while (!pipeline.pushIfNodeAvailable([i](Message& message) {
+          message.value = i;
+          message.origin = &message;
+        })) {
+          std::this_thread::yield();
+        }
+      }
+    }).join();
+    for (int i = 0; i < 5000 && numReceived.load() < numMessages; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (int stage = 0; stage < pipeline.getNumStages(); ++stage) {
+      auto const stats = pipeline.getStageStats(stage);
+      success = success && stats.numProcessed == numMessages && stats.maxProcessingTime >= 0 &&
+                stats.totalWaitTime >= stats.maxWaitTime;
+    }
+    success = success && pipeline.getStageStats(0).numBackpressureStalls > 0 && pipeline.getNumRejectedPushes() > 0;
+  }
+  success = success && numReceived.load() == numMessages && isInOrder && isNeverCopied &&
+            sum == static_cast<int64_t>(numMessages) * numMessages;
+  // several source threads pushing at once never find the nodes taken by each other
+  int const numSources = 4;
+  int const numMessagesPerSource = 200;
+  std::atomic<int> numSunk{ 0 };
+  {
+    auto pipeline = lockfree::Pipeline<Message>(numSources * numMessagesPerSource);
+    pipeline.addStage([&](Message&) { ++numSunk; }, numSources * numMessagesPerSource);
+    auto sources = std::vector<std::thread>();
+    for (int i = 0; i < numSources; ++i) {
+      sources.emplace_back([&] {
+        for (int j = 0; j < numMessagesPerSource; ++j) {
+          pipeline.pushIfNodeAvailable([j](Message& message) { message.value = j; });
+        }
+      });
+    }
+    for (auto& source : sources) {
+      source.join();
+    }
+    pipeline.start();
+    for (int i = 0; i < 5000 && numSunk.load() < numSources * numMessagesPerSource; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    success = success && pipeline.getNumRejectedPushes() == 0 && numSunk.load() == numSources * numMessagesPerSource;
+  }
+  std::cout << "pipeline test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testDisruptor()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING DISRUPTOR\n";
+  struct Event
+  {
+    int64_t value{ 0 };
+    int64_t square{ 0 };
+  };
+  int64_t const numEvents = 100000;
+  auto disruptor = lockfree::Disruptor<Event>(100);
+  auto& recorder = disruptor.addConsumer();
+  auto& analyser = disruptor.addConsumer({ &recorder });
+  auto& display = disruptor.addConsumer({ &analyser });
+  auto& monitor = disruptor.addConsumer();
+  bool success = disruptor.getCapacity() == 128;
+  int64_t recorderSum = 0;
+  bool isAnalysisSeen = true;
+  bool isMonitorInOrder = true;
+  auto runConsumer = [&](lockfree::Disruptor<Event>::Consumer& consumer, auto handler) {
+    return std::thread([&consumer, handler]() mutable {
+      while (consumer.getSequence() < numEvents - 1) {
+        if (consumer.consume(handler, 16) == 0) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  };
+  auto threads = std::vector<std::thread>();
+  threads.push_back(runConsumer(recorder, [&](Event& event, int64_t) { recorderSum += event.value; }));
+  threads.push_back(runConsumer(analyser, [](Event& event, int64_t) { event.square = event.value * event.value; }));
+  threads.push_back(runConsumer(display, [&](Event& event, int64_t sequence) {
+    isAnalysisSeen = isAnalysisSeen && event.value == sequence && event.square == sequence * sequence;
+  }));
+  // a consumer that claims the available events and releases them itself
+  threads.emplace_back([&] {
+    int64_t expected = 0;
+    while (monitor.getSequence() < numEvents - 1) {
+      auto const available = monitor.getAvailableSequence();
+      for (auto i = monitor.getSequence() + 1; i <= available; ++i) {
+        isMonitorInOrder = isMonitorInOrder && monitor.get(i).value == expected++;
+      }
+      monitor.release(available);
+    }
+  });
+  int64_t numWritten = 0;
+  while (numWritten < numEvents) {
+    numWritten += disruptor.tryWrite(std::min<int64_t>(32, numEvents - numWritten), [](Event& event, int64_t sequence) {
+      event.value = sequence;
+      event.square = 0;
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  success = success && disruptor.getCursor() == numEvents - 1 && recorderSum == numEvents * (numEvents - 1) / 2 &&
+            isAnalysisSeen && isMonitorInOrder;
+  // an unbounded request fills the ring without overflowing the sequence arithmetic
+  auto const writeAll = [](Event& event, int64_t sequence) { event.value = sequence; };
+  success = success && disruptor.tryWrite(INT64_MAX, writeAll) == disruptor.getCapacity() &&
+            disruptor.tryWrite(INT64_MAX, writeAll) == 0;
+  std::cout << "disruptor test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testMessengerNotification()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING MESSENGER NOTIFICATION\n";
+  auto messenger = lockfree::Messenger<int>();
+  messenger.allocateNodes(4);
+  auto isFdReadable = [&](int timeoutMs) {
+#if defined(__unix__) || defined(__APPLE__)
+    auto pollFd = pollfd{ messenger.getNotificationFd(), POLLIN, 0 };
+    return ::poll(&pollFd, 1, timeoutMs) == 1;
+#else
+    return true;
+#endif
+  };
+  bool success = messenger.getNotificationFd() == -1 && !messenger.drainNotification();
+  messenger.enableNotification();
+#if defined(__unix__) || defined(__APPLE__)
+  success = success && messenger.getNotificationFd() >= 0 && !isFdReadable(0);
+#endif
+  std::thread([&] {
+    for (int i = 0; i < 3; ++i) {
+      messenger.sendIfNodeAvailable(std::move(i));
+    }
+  }).join();
+  success = success && isFdReadable(1000) && messenger.drainNotification();
+  int numReceived = receiveAndHandleMessageStack(messenger, [](int&) {});
+  success = success && numReceived == 3 && !messenger.drainNotification();
+#if defined(__unix__) || defined(__APPLE__)
+  success = success && !isFdReadable(0);
+#endif
+  // only the transition from empty to non-empty notifies
+  messenger.sendIfNodeAvailable(3);
+  success = success && messenger.drainNotification();
+  messenger.sendIfNodeAvailable(4);
+  success = success && !messenger.drainNotification();
+  // messages sent before the notification is enabled are notified when it is
+  auto other = lockfree::Messenger<int>();
+  other.send(5);
+  other.enableNotification();
+  success = success && other.drainNotification();
+#if defined(__unix__) || defined(__APPLE__)
+  // an event loop that waits, drains and receives while a sender keeps sending is always woken up again
+  auto stream = lockfree::Messenger<int>();
+  stream.enableNotification();
+  int const numMessages = 100000;
+  auto sender = std::thread([&] {
+    for (int i = 0; i < numMessages; ++i) {
+      stream.send(std::move(i));
+    }
+  });
+  int numStreamed = 0;
+  while (numStreamed < numMessages) {
+    auto pollFd = pollfd{ stream.getNotificationFd(), POLLIN, 0 };
+    if (::poll(&pollFd, 1, 1000) != 1) {
+      // the fd was not re-armed
+      success = false;
+      break;
+    }
+    stream.drainNotification();
+    numStreamed += receiveAndHandleMessageStack(stream, [](int&) {});
+  }
+  sender.join();
+  success = success && numStreamed == numMessages;
+  // a notification made while the consumer drains must not leave the fd unreadable
+  auto notifier = lockfree::EventNotifier();
+  std::atomic<bool> isNotifying{ true };
+  auto notifyingThread = std::thread([&] {
+    while (isNotifying.load(std::memory_order_relaxed)) {
+      notifier.notify();
+    }
+  });
+  for (int i = 0; i < 10000 && success; ++i) {
+    auto pollFd = pollfd{ notifier.getFd(), POLLIN, 0 };
+    success = ::poll(&pollFd, 1, 1000) == 1;
+    notifier.drain();
+  }
+  isNotifying = false;
+  notifyingThread.join();
+#endif
+  std::cout << "messenger notification test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testRealtimeRegistry()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING REALTIME REGISTRY\n";
+  static std::atomic<int> numAlive{ 0 };
+  struct Wavetable
+  {
+    Wavetable(uint64_t id, int version)
+      : id{ id }
+      , samples(64, static_cast<float>(version))
+    {
+      ++numAlive;
+    }
+    ~Wavetable()
+    {
+      --numAlive;
+    }
+    uint64_t id;
+    std::vector<float> samples;
+  };
+  bool success = true;
+  {
+    auto registry = lockfree::RealtimeRegistry<Wavetable>(16, 2);
+    auto reader = registry.registerReader();
+    auto otherReader = registry.registerReader();
+    success = reader && otherReader && !registry.registerReader();
+    // a held guard keeps the replaced objects alive
+    success = registry.set(1, std::make_unique<Wavetable>(1, 0)) && success;
+    {
+      auto guard = reader->read();
+      auto const wavetable = guard.find(1);
+      success = registry.set(1, std::make_unique<Wavetable>(1, 1)) && registry.collect() == 1 && success;
+      success = success && wavetable->samples[0] == 0.f && guard.find(1)->samples[0] == 1.f && !guard.find(2);
+    }
+    success = success && registry.collect() == 0 && numAlive.load() == 1;
+    success = registry.remove(1) && !registry.remove(1) && success;
+    success = success && registry.collect() == 0 && numAlive.load() == 0 && !reader->read().find(1);
+    // concurrent lookups while the objects are replaced and removed
+    std::atomic<bool> isWriting{ true };
+    std::atomic<bool> isConsistent{ true };
+    auto readerThread = std::thread([&, reader = std::move(*reader)]() mutable {
+      while (isWriting.load()) {
+        auto guard = reader.read();
+        for (uint64_t id = 0; id < 16; ++id) {
+          if (auto const wavetable = guard.find(id)) {
+            bool const isWavetableConsistent =
+              wavetable->id == id && std::all_of(wavetable->samples.begin(), wavetable->samples.end(), [&](float x) {
+                return x == wavetable->samples[0];
+              });
+            if (!isWavetableConsistent) {
+              isConsistent = false;
+            }
+          }
+        }
+      }
+    });
+    for (int version = 0; version < 2000; ++version) {
+      auto const id = static_cast<uint64_t>(version % 16);
+      if (version % 7 == 0) {
+        registry.remove(id);
+      }
+      else {
+        success = registry.set(id, std::make_unique<Wavetable>(id, version)) && success;
+      }
+    }
+    isWriting = false;
+    readerThread.join();
+    success = success && isConsistent.load() && registry.collect() == 0 && numAlive.load() <= 16;
+    // the capacity bounds the number of distinct ids
+    for (uint64_t id = 0; id < 16; ++id) {
+      success = registry.set(id, std::make_unique<Wavetable>(id, 0)) && success;
+    }
+    success = success && !registry.set(16, std::make_unique<Wavetable>(16, 0)) && registry.set(3, nullptr);
+  }
+  success = success && numAlive.load() == 0;
+  std::cout << "realtime registry test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
+bool testNodePool()
+{
+  std::cout << "===========================================================\n";
+  std::cout << "TESTING NODE POOL\n";
+  int const numNodes = 1000;
+  auto pool = lockfree::NodePool<int>();
+  bool success = pool.allocateNodes(numNodes) == numNodes && pool.getNumNodes() == numNodes;
+  // the nodes span several chunks, and each is taken once
+  auto taken = std::vector<lockfree::MessageNode<int>*>();
+  while (auto node = pool.pop()) {
+    taken.push_back(node);
+  }
+  std::sort(taken.begin(), taken.end());
+  success = success && static_cast<int>(taken.size()) == numNodes &&
+            std::adjacent_find(taken.begin(), taken.end()) == taken.end();
+  auto const extra = pool.popOrAllocate();
+  success = success && extra && pool.getNumNodes() == numNodes + 1 && !pool.pop();
+  for (auto node : taken) {
+    node->next() = nullptr;
+    pool.recycle(node);
+  }
+  pool.recycle(extra);
+  // several threads take and give back nodes, and no node is ever held by two of them
+  int const numThreads = 4;
+  int const numIterations = 20000;
+  std::atomic<bool> isAnyNodeShared{ false };
+  std::atomic<int> numFailedPops{ 0 };
+  auto threads = std::vector<std::thread>();
+  for (int t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < numIterations; ++i) {
+        auto first = pool.pop();
+        auto second = pool.pop();
+        if (!first || !second) {
+          ++numFailedPops;
+          pool.recycle(first);
+          pool.recycle(second);
+          continue;
+        }
+        if (first->get() != 0 || second->get() != 0) {
+          isAnyNodeShared = true;
+        }
+        first->get() = second->get() = t + 1;
+        std::this_thread::yield();
+        if (first->get() != t + 1 || second->get() != t + 1) {
+          isAnyNodeShared = true;
+        }
+        first->get() = second->get() = 0;
+        first->next() = second;
+        pool.recycle(first);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  int numFree = 0;
+  while (pool.pop()) {
+    ++numFree;
+  }
+  success = success && !isAnyNodeShared && numFailedPops == 0 && numFree == numNodes + 1;
+  std::cout << "node pool test " << (success ? "succeeded" : "FAILED") << "\n";
+  std::cout << "===========================================================\n\n\n\n";
+  return success;
+}
+
 int main()
 {
   test(1, 4);
   test(2, 4);
   test(4, 4);
+  bool success = testInstanceGroup();
+  success = testImplicitProducers() && success;
+  success = testMoveOnlySettings() && success;
+  success = testSnapshotPublisher() && success;
+  success = testTransaction() && success;
+  success = testPersistentMap() && success;
+  success = testComponents() && success;
+  success = testExternallyDrivenAsyncThread() && success;
+  success = testTimerWheel() && success;
+  success = testPerObjectUpdatePeriods() && success;
+  success = testAdaptiveUpdatePeriod() && success;
+  success = testDeadlineScheduling() && success;
+  success = testThreadConfiguration() && success;
+  success = testAsyncThreadStats() && success;
+  success = testDeferredDeleter() && success;
+  success = testRealtimeLogger() && success;
+  success = testMetricsRegistry() && success;
+  success = testRequestChannel() && success;
+  success = testTaskPool() && success;
+  success = testFifoMessenger() && success;
+  success = testPipeline() && success;
+  success = testDisruptor() && success;
+  success = testMessengerNotification() && success;
+  success = testRealtimeRegistry() && success;
+  success = testNodePool() && success;
+  return success ? 0 : 1;
 }